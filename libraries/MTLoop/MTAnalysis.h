@@ -0,0 +1,263 @@
+/*
+ * MTAnalysis.h
+ * Анализ выполнимости расписания: загрузка, период цепочек и граница опоздания
+ * старта тайм-слотов при кооперативной (непрерываемой) диспетчеризации TLoop
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace MT {
+
+    // ///////////////////////// //
+    //      TScheduleModel       //
+    // ///////////////////////// //
+    // Тайм-слот для анализа: окно, отступ и худшая длительность задачи (WCET)
+    struct TSlotBudget {
+        tick_t minDuration;
+        tick_t padding;
+        tick_t wcet;
+    };
+
+    struct TChainModel {
+        std::string name;
+        uint8_t priority;
+        std::vector<TSlotBudget> slots;
+    };
+
+    const uint64_t UNBOUNDED_LATENESS = static_cast<uint64_t>(-1);
+
+    struct TSlotAnalysis {
+        tick_t minDuration;
+        tick_t wcet;                // С учетом масштаба процессора
+        uint64_t response;          // Граница окончания задачи от начала тайм-слота
+        bool fits;                  // response + padding укладывается в minDuration
+    };
+
+    struct TChainAnalysis {
+        std::string name;
+        uint8_t priority;
+        uint64_t nominalPeriod;     // Сумма minDuration
+        uint64_t period;            // Сумма max(minDuration, wcet + padding)
+        double utilization;         // Сумма wcet / period
+        uint64_t lateness;          // Граница опоздания старта тайм-слота
+        bool feasible;
+        std::vector<TSlotAnalysis> slots;
+    };
+
+    struct TScheduleAnalysis {
+        TDispatchPolicy policy;
+        double utilization;
+        bool feasible;
+        std::vector<TChainAnalysis> chains;
+        std::vector<std::string> problems;
+    };
+
+    // Описание расписания: цепочки задаются вручную или по подключенным
+    // TTimeSlotChain, WCET берется из максимума гистограммы длительностей TStat.
+    // cpuScale пересчитывает замеры на другой процессор: 2 - вдвое медленнее.
+    class TScheduleModel {
+        public:
+            explicit TScheduleModel(TDispatchPolicy policy = DISPATCH_ROUND_ROBIN, double cpuScale = 1.0);
+            size_t AddChain(const std::string& name, std::initializer_list<TSlotBudget> slots,
+                            uint8_t priority = DEFAULT_CHAIN_PRIORITY);
+            size_t AddChain(const std::string& name, TTimeSlotChain& chain, uint8_t priority = DEFAULT_CHAIN_PRIORITY);
+            size_t AddChain(const TChainModel& chain);
+            TChainModel& GetChain(size_t index);
+            size_t GetChainCount() const;
+            void SetPolicy(TDispatchPolicy policy);
+            void SetCpuScale(double scale);
+            TScheduleAnalysis Analyze() const;
+        private:
+            tick_t Scale(tick_t wcet) const;
+            uint64_t Lateness(size_t chain, const std::vector<uint64_t>& wcet, const std::vector<uint64_t>& spacing) const;
+
+            TDispatchPolicy policy;
+            double cpuScale;
+            std::vector<TChainModel> chains;
+    };
+
+    // Худшая длительность задачи по статистике тайм-слота
+    tick_t MeasuredWcet(TTimeSlot& slot);
+    void WriteScheduleReport(std::ostream& out, const TScheduleAnalysis& analysis);
+
+
+    inline tick_t MeasuredWcet(TTimeSlot& slot) {
+#if MTLOOP_STAT_HISTOGRAM
+        if (slot.GetStat().GetDurationHistogram().GetCount() > 0)
+            return slot.GetStat().GetDurationHistogram().GetMax();
+#endif
+        return slot.GetStat().GetDuration();
+    }
+
+    inline TScheduleModel::TScheduleModel(TDispatchPolicy policy, double cpuScale)
+        : policy(policy)
+        , cpuScale(cpuScale) {
+    }
+    inline size_t TScheduleModel::AddChain(const std::string& name, std::initializer_list<TSlotBudget> slots, uint8_t priority) {
+        return AddChain(TChainModel { name, priority, std::vector<TSlotBudget>(slots) });
+    }
+    inline size_t TScheduleModel::AddChain(const std::string& name, TTimeSlotChain& chain, uint8_t priority) {
+        TChainModel model { name, priority, {} };
+        for (size_t i = 0; i < chain.Size(); ++i) {
+            TTimeSlot& slot = chain.At(i);
+            model.slots.push_back(TSlotBudget { slot.GetMinDuration(), slot.GetPadding(), MeasuredWcet(slot) });
+        }
+        return AddChain(model);
+    }
+    inline size_t TScheduleModel::AddChain(const TChainModel& chain) {
+        chains.push_back(chain);
+        return chains.size() - 1;
+    }
+    inline TChainModel& TScheduleModel::GetChain(size_t index) {
+        return chains[index];
+    }
+    inline size_t TScheduleModel::GetChainCount() const {
+        return chains.size();
+    }
+    inline void TScheduleModel::SetPolicy(TDispatchPolicy value) {
+        policy = value;
+    }
+    inline void TScheduleModel::SetCpuScale(double scale) {
+        cpuScale = scale;
+    }
+    inline tick_t TScheduleModel::Scale(tick_t wcet) const {
+        return static_cast<tick_t>(wcet * cpuScale + 0.5);
+    }
+    // Задачи не прерываются, у цепочки в каждый момент один текущий тайм-слот.
+    // DISPATCH_DEADLINE: раньше нашего тайм-слота запустятся только тайм-слоты
+    // с более ранним началом - не больше одного от каждой другой цепочки.
+    // DISPATCH_ROUND_ROBIN: за один круг каждая другая цепочка выполняется
+    // не больше одного раза. Граница в обоих случаях - сумма их WCET.
+    // DISPATCH_PRIORITY: одна задача младшего класса, уже начатая, по одной от
+    // цепочек своего класса и все выполнения старших классов за время ожидания
+    // (итерация как в анализе времени отклика для непрерываемых задач).
+    inline uint64_t TScheduleModel::Lateness(size_t chain, const std::vector<uint64_t>& wcet, const std::vector<uint64_t>& spacing) const {
+        uint64_t sameClass = 0;
+        uint64_t blocking = 0;
+        for (size_t j = 0; j < chains.size(); ++j) {
+            if (j == chain)
+                continue;
+            if (policy != DISPATCH_PRIORITY || chains[j].priority == chains[chain].priority)
+                sameClass += wcet[j];
+            else if (chains[j].priority < chains[chain].priority && wcet[j] > blocking)
+                blocking = wcet[j];
+        }
+        if (policy != DISPATCH_PRIORITY)
+            return sameClass;
+        // Старшие классы выполняются, пока наш тайм-слот ждет
+        uint64_t limit = 0;
+        for (size_t j = 0; j < chains.size(); ++j)
+            for (const TSlotBudget& slot : chains[j].slots)
+                limit += slot.minDuration + slot.padding + wcet[j];
+        limit = limit * 64 + 1;
+        uint64_t wait = blocking + sameClass;
+        for (;;) {
+            uint64_t next = blocking + sameClass;
+            for (size_t j = 0; j < chains.size(); ++j) {
+                if (chains[j].priority <= chains[chain].priority)
+                    continue;
+                if (spacing[j] == 0)
+                    return UNBOUNDED_LATENESS;
+                next += (wait / spacing[j] + 1) * wcet[j];
+            }
+            if (next == wait)
+                return wait;
+            if (next > limit)
+                return UNBOUNDED_LATENESS;
+            wait = next;
+        }
+    }
+    inline TScheduleAnalysis TScheduleModel::Analyze() const {
+        TScheduleAnalysis analysis;
+        analysis.policy = policy;
+        analysis.utilization = 0;
+        analysis.feasible = true;
+        // Худшая задача цепочки и минимальный интервал между стартами ее тайм-слотов
+        std::vector<uint64_t> wcet(chains.size(), 0);
+        std::vector<uint64_t> spacing(chains.size(), 0);
+        for (size_t c = 0; c < chains.size(); ++c) {
+            bool first = true;
+            for (const TSlotBudget& slot : chains[c].slots) {
+                if (Scale(slot.wcet) > wcet[c])
+                    wcet[c] = Scale(slot.wcet);
+                uint64_t step = slot.minDuration > slot.padding ? slot.minDuration : slot.padding;
+                if (first || step < spacing[c])
+                    spacing[c] = step;
+                first = false;
+            }
+        }
+        for (size_t c = 0; c < chains.size(); ++c) {
+            const TChainModel& model = chains[c];
+            TChainAnalysis chain;
+            chain.name = model.name;
+            chain.priority = model.priority;
+            chain.nominalPeriod = 0;
+            chain.period = 0;
+            chain.lateness = Lateness(c, wcet, spacing);
+            chain.feasible = chain.lateness != UNBOUNDED_LATENESS;
+            uint64_t busy = 0;
+            for (const TSlotBudget& budget : model.slots) {
+                TSlotAnalysis slot;
+                slot.minDuration = budget.minDuration;
+                slot.wcet = Scale(budget.wcet);
+                uint64_t own = static_cast<uint64_t>(slot.wcet) + budget.padding;
+                chain.nominalPeriod += budget.minDuration;
+                chain.period += own > budget.minDuration ? own : budget.minDuration;
+                busy += slot.wcet;
+                slot.response = chain.lateness == UNBOUNDED_LATENESS ? UNBOUNDED_LATENESS : chain.lateness + slot.wcet;
+                // Тайм-слот без окна (minDuration = 0) выполняется по возможности
+                slot.fits = budget.minDuration == 0
+                    || (slot.response != UNBOUNDED_LATENESS && slot.response + budget.padding <= budget.minDuration);
+                if (!slot.fits) {
+                    chain.feasible = false;
+                    analysis.problems.push_back(model.name + ": slot " + std::to_string(chain.slots.size())
+                        + " needs " + (slot.response == UNBOUNDED_LATENESS ? std::string("unbounded time")
+                                       : std::to_string(slot.response + budget.padding))
+                        + " of " + std::to_string(budget.minDuration) + " ticks");
+                }
+                chain.slots.push_back(slot);
+            }
+            chain.utilization = chain.period > 0 ? static_cast<double>(busy) / chain.period : 0;
+            if (chain.lateness == UNBOUNDED_LATENESS)
+                analysis.problems.push_back(model.name + ": higher priority chains may starve it");
+            analysis.utilization += chain.utilization;
+            analysis.feasible = analysis.feasible && chain.feasible;
+            analysis.chains.push_back(chain);
+        }
+        if (analysis.utilization > 1.0) {
+            analysis.feasible = false;
+            analysis.problems.push_back("total utilization " + std::to_string(analysis.utilization) + " exceeds 1");
+        }
+        return analysis;
+    }
+
+    inline void WriteScheduleReport(std::ostream& out, const TScheduleAnalysis& analysis) {
+        const char* policyName = analysis.policy == DISPATCH_DEADLINE ? "deadline"
+                               : analysis.policy == DISPATCH_PRIORITY ? "priority" : "round-robin";
+        out << "policy " << policyName << ", utilization " << analysis.utilization * 100 << "%, "
+            << (analysis.feasible ? "feasible" : "INFEASIBLE") << "\n";
+        out << "chain,priority,nominal_period,period,utilization,lateness,worst_response,feasible\n";
+        for (const TChainAnalysis& chain : analysis.chains) {
+            uint64_t worst = 0;
+            for (const TSlotAnalysis& slot : chain.slots)
+                if (slot.response > worst)
+                    worst = slot.response;
+            out << chain.name << "," << static_cast<unsigned>(chain.priority) << "," << chain.nominalPeriod << ","
+                << chain.period << "," << chain.utilization << ",";
+            if (chain.lateness == UNBOUNDED_LATENESS)
+                out << "unbounded,unbounded,";
+            else
+                out << chain.lateness << "," << worst << ",";
+            out << (chain.feasible ? "yes" : "no") << "\n";
+        }
+        for (const std::string& problem : analysis.problems)
+            out << "problem: " << problem << "\n";
+    }
+
+}
@@ -0,0 +1,308 @@
+/*
+ * MTCoroutine.h
+ * Задачи-сопрограммы C++20 для хостов с поддержкой <coroutine>
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <atomic>
+#include <coroutine>
+
+namespace MT {
+
+    // ///////////////////////// //
+    //       TCoFramePool        //
+    // ///////////////////////// //
+    // Пул кадров сопрограмм: BlockCount блоков по BlockSize байт в статической
+    // памяти, список свободных блоков. Кадр, который не помещается в блок, или
+    // кадр сверх BlockCount не создается - TCoTask получается пустым.
+#ifndef MTLOOP_CO_FRAME_SIZE
+#define MTLOOP_CO_FRAME_SIZE 512
+#endif
+#ifndef MTLOOP_CO_FRAME_COUNT
+#define MTLOOP_CO_FRAME_COUNT 16
+#endif
+    template<size_t BlockSize, size_t BlockCount>
+    class TCoFramePool {
+        public:
+            TCoFramePool();
+            void* Allocate(size_t size);
+            void Free(void* p);
+            size_t GetFreeCount() const;
+        private:
+            union TBlock {
+                TBlock* next;
+                alignas(std::max_align_t) unsigned char data[BlockSize];
+            };
+
+            TBlock blocks[BlockCount];
+            TBlock* freeHead;
+            size_t freeCount;
+            std::atomic_flag lock = ATOMIC_FLAG_INIT;   // Сопрограммы могут создаваться в разных потоках
+    };
+
+    template<size_t BlockSize, size_t BlockCount>
+    inline TCoFramePool<BlockSize, BlockCount>::TCoFramePool()
+        : freeHead(nullptr)
+        , freeCount(BlockCount) {
+        for (size_t i = BlockCount; i > 0; --i) {
+            blocks[i - 1].next = freeHead;
+            freeHead = &blocks[i - 1];
+        }
+    }
+    template<size_t BlockSize, size_t BlockCount>
+    inline void* TCoFramePool<BlockSize, BlockCount>::Allocate(size_t size) {
+        if (size > BlockSize)
+            return nullptr;
+        while (lock.test_and_set(std::memory_order_acquire)) {
+        }
+        TBlock* block = freeHead;
+        if (block != nullptr) {
+            freeHead = block->next;
+            freeCount--;
+        }
+        lock.clear(std::memory_order_release);
+        return block;
+    }
+    template<size_t BlockSize, size_t BlockCount>
+    inline void TCoFramePool<BlockSize, BlockCount>::Free(void* p) {
+        TBlock* block = static_cast<TBlock*>(p);
+        while (lock.test_and_set(std::memory_order_acquire)) {
+        }
+        block->next = freeHead;
+        freeHead = block;
+        freeCount++;
+        lock.clear(std::memory_order_release);
+    }
+    template<size_t BlockSize, size_t BlockCount>
+    inline size_t TCoFramePool<BlockSize, BlockCount>::GetFreeCount() const {
+        return freeCount;
+    }
+
+    using TDefaultCoFramePool = TCoFramePool<MTLOOP_CO_FRAME_SIZE, MTLOOP_CO_FRAME_COUNT>;
+
+    inline TDefaultCoFramePool& CoFramePool() {
+        static TDefaultCoFramePool pool;
+        return pool;
+    }
+
+
+    // ///////////////////////// //
+    //          TCoTask          //
+    // ///////////////////////// //
+    // Тип результата сопрограммы-задачи:
+    //
+    //     MT::TCoTask Blink() {
+    //         for (;;) {
+    //             LedOn();
+    //             co_await MT::SleepFor(500);
+    //             LedOff();
+    //             co_await MT::NextSlot();
+    //         }
+    //     }
+    //
+    // Сопрограмма стартует не сразу, а при первом запуске цепочки TCoChain.
+    enum TCoWait {
+        CO_WAIT_NEXT_SLOT,      // До начала следующего тайм-слота
+        CO_WAIT_SLEEP           // sleepTicks тиков после окончания выполнения
+    };
+
+    class TCoTask {
+        public:
+            struct promise_type {
+                TCoWait wait = CO_WAIT_NEXT_SLOT;
+                tick_t sleepTicks = 0;
+
+                static void* operator new(size_t size) noexcept;
+                static void operator delete(void* p) noexcept;
+                static TCoTask get_return_object_on_allocation_failure() noexcept;
+                TCoTask get_return_object() noexcept;
+                std::suspend_always initial_suspend() noexcept;
+                std::suspend_always final_suspend() noexcept;
+                void return_void() noexcept;
+                void unhandled_exception() noexcept;
+            };
+            using THandle = std::coroutine_handle<promise_type>;
+
+            TCoTask() noexcept = default;
+            TCoTask(TCoTask&& task) noexcept;
+            TCoTask& operator=(TCoTask&& task) noexcept;
+            TCoTask(const TCoTask&) = delete;
+            TCoTask& operator=(const TCoTask&) = delete;
+            ~TCoTask();
+            bool IsValid() const;   // Кадр выделен
+            bool IsDone() const;
+            void Resume();
+            promise_type& GetPromise();
+        private:
+            explicit TCoTask(THandle handle) noexcept;
+
+            THandle handle;
+    };
+
+    inline void* TCoTask::promise_type::operator new(size_t size) noexcept {
+        return CoFramePool().Allocate(size);
+    }
+    inline void TCoTask::promise_type::operator delete(void* p) noexcept {
+        CoFramePool().Free(p);
+    }
+    inline TCoTask TCoTask::promise_type::get_return_object_on_allocation_failure() noexcept {
+        return TCoTask();
+    }
+    inline TCoTask TCoTask::promise_type::get_return_object() noexcept {
+        return TCoTask(THandle::from_promise(*this));
+    }
+    inline std::suspend_always TCoTask::promise_type::initial_suspend() noexcept {
+        return {};
+    }
+    inline std::suspend_always TCoTask::promise_type::final_suspend() noexcept {
+        return {};
+    }
+    inline void TCoTask::promise_type::return_void() noexcept {
+    }
+    inline void TCoTask::promise_type::unhandled_exception() noexcept {
+    }
+
+    inline TCoTask::TCoTask(THandle handle) noexcept
+        : handle(handle) {
+    }
+    inline TCoTask::TCoTask(TCoTask&& task) noexcept
+        : handle(task.handle) {
+        task.handle = nullptr;
+    }
+    inline TCoTask& TCoTask::operator=(TCoTask&& task) noexcept {
+        if (this != &task) {
+            if (handle)
+                handle.destroy();
+            handle = task.handle;
+            task.handle = nullptr;
+        }
+        return *this;
+    }
+    inline TCoTask::~TCoTask() {
+        if (handle)
+            handle.destroy();
+    }
+    inline bool TCoTask::IsValid() const {
+        return static_cast<bool>(handle);
+    }
+    inline bool TCoTask::IsDone() const {
+        return !handle || handle.done();
+    }
+    inline void TCoTask::Resume() {
+        handle.resume();
+    }
+    inline TCoTask::promise_type& TCoTask::GetPromise() {
+        return handle.promise();
+    }
+
+
+    // ///////////////////////// //
+    //    NextSlot / SleepFor    //
+    // ///////////////////////// //
+    // Точки ожидания: сопрограмма возвращает управление планировщику, цепочка
+    // TCoChain продолжает ее в следующем тайм-слоте или через ticks тиков
+    class TCoAwait {
+        public:
+            TCoAwait(TCoWait wait, tick_t ticks);
+            bool await_ready() const noexcept;
+            void await_suspend(TCoTask::THandle handle) const noexcept;
+            void await_resume() const noexcept;
+        private:
+            TCoWait wait;
+            tick_t ticks;
+    };
+
+    inline TCoAwait::TCoAwait(TCoWait wait, tick_t ticks)
+        : wait(wait)
+        , ticks(ticks) {
+    }
+    inline bool TCoAwait::await_ready() const noexcept {
+        return false;
+    }
+    inline void TCoAwait::await_suspend(TCoTask::THandle handle) const noexcept {
+        handle.promise().wait = wait;
+        handle.promise().sleepTicks = ticks;
+    }
+    inline void TCoAwait::await_resume() const noexcept {
+    }
+
+    inline TCoAwait NextSlot() {
+        return TCoAwait(CO_WAIT_NEXT_SLOT, 0);
+    }
+    inline TCoAwait SleepFor(tick_t ticks) {
+        return TCoAwait(CO_WAIT_SLEEP, ticks);
+    }
+
+
+    // ///////////////////////// //
+    //         TCoChain          //
+    // ///////////////////////// //
+    // Цепочка из одной сопрограммы. Каждое продолжение сопрограммы - отдельное
+    // выполнение тайм-слота длиной minDuration с учетом в TStat. Подключается
+    // к TLoop через Attach(IChain&), как TTimeSlotChain. Когда сопрограмма
+    // завершилась, цепочка помечает себя завершенной (IsFinished) и TLoop ее
+    // отсоединяет; Run() завершенной цепочки возвращает false.
+    class TCoChain final: public IChain {
+        public:
+            TCoChain(TCoTask&& task, tick_t minDuration = DEFAULT_SLOT_MIN_DURATION, tick_t padding = DEFAULT_SLOT_PADDING);
+            bool Run(TLog& log) override;
+            bool Run(TLog& log, tick_t tm) override;
+            tick_t GetLTime() override;
+            void SetStartTime(tick_t time);
+            bool IsDone() const;    // Сопрограмма завершилась или кадр не выделен
+            TStat& GetStat();
+        private:
+            TCoTask task;
+            TStat stat;
+            tick_t slotStartTime = 1;
+            tick_t minDuration;
+            tick_t padding;
+    };
+
+    inline TCoChain::TCoChain(TCoTask&& task, tick_t minDuration, tick_t padding)
+        : task(static_cast<TCoTask&&>(task))
+        , minDuration(minDuration)
+        , padding(padding) {
+    }
+    inline bool TCoChain::Run(TLog& log) {
+        return Run(log, TTimer::GetTime());
+    }
+    inline bool TCoChain::Run(TLog& log, tick_t tm) {
+        if (task.IsDone()) {
+            Finish();
+            return false;
+        }
+        if (TimeBefore(tm, slotStartTime))
+            return false;
+        TraceSlot(0);
+        task.Resume();
+        tick_t stopTime = TTimer::GetTime();
+        stat.SetStartTime(tm);
+        stat.SetStopTime(stopTime);
+        stat.Sample(slotStartTime);
+        TraceExecution(slotStartTime, tm, stopTime, true);
+        if (task.IsDone()) {
+            Finish();
+        } else if (task.GetPromise().wait == CO_WAIT_SLEEP) {
+            slotStartTime = stopTime + task.GetPromise().sleepTicks;
+        } else {
+            slotStartTime = SlotRTime(stopTime, slotStartTime, minDuration, padding, true, stopTime) + 1;
+        }
+        return true;
+    }
+    inline tick_t TCoChain::GetLTime() {
+        return slotStartTime;
+    }
+    inline void TCoChain::SetStartTime(tick_t time) {
+        slotStartTime = time;
+    }
+    inline bool TCoChain::IsDone() const {
+        return task.IsDone();
+    }
+    inline TStat& TCoChain::GetStat() {
+        return stat;
+    }
+
+}
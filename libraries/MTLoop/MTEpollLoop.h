@@ -0,0 +1,202 @@
+/*
+ * MTEpollLoop.h
+ * Планировщик с источниками событий epoll для Linux
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+namespace MT {
+
+    // ///////////////////////// //
+    //         TEventFd          //
+    // ///////////////////////// //
+    // Счетчик событий eventfd: Notify() из любого потока будит epoll_wait
+    class TEventFd {
+        public:
+            TEventFd();
+            ~TEventFd();
+            TEventFd(const TEventFd&) = delete;
+            TEventFd& operator=(const TEventFd&) = delete;
+            int GetFd() const;
+            bool Notify(uint64_t value = 1);
+            uint64_t Drain();       // Сбрасывает счетчик, возвращает накопленное значение
+        private:
+            int fd;
+    };
+
+    inline TEventFd::TEventFd()
+        : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    }
+    inline TEventFd::~TEventFd() {
+        if (fd >= 0)
+            close(fd);
+    }
+    inline int TEventFd::GetFd() const {
+        return fd;
+    }
+    inline bool TEventFd::Notify(uint64_t value) {
+        return write(fd, &value, sizeof(value)) == sizeof(value);
+    }
+    inline uint64_t TEventFd::Drain() {
+        uint64_t value = 0;
+        if (read(fd, &value, sizeof(value)) != sizeof(value))
+            return 0;
+        return value;
+    }
+
+
+    // ///////////////////////// //
+    //        TEpollLoop         //
+    // ///////////////////////// //
+    // TLoop, который между проходами спит в epoll_wait до ближайшего срока
+    // цепочки или таймера. Задача, привязанная к файловому дескриптору через
+    // Watch(), выполняется сразу после того, как дескриптор стал готов, без
+    // опроса в Run(). Дескрипторы работают в режиме level-triggered: задача,
+    // вернувшая false или не дочитавшая данные, будет вызвана на следующем проходе.
+    class TEpollLoop: public TLoop {
+        public:
+            static const int MAX_EVENTS = 32;   // Событий за один epoll_wait
+
+            TEpollLoop(size_t count = DEFAULT_SLOT_CHAIN_COUNT, TLog& log = defaultLog, TDispatchPolicy policy = DISPATCH_ROUND_ROBIN);
+            ~TEpollLoop();
+            bool Watch(int fd, uint32_t events, const TCallable& task);
+            bool Unwatch(int fd);
+            size_t GetWatchCount() const;
+            TStat* GetStat(int fd);
+            // Ожидание событий и ближайшего срока, но не дольше maxWaitMs (-1 - без ограничения),
+            // затем выполнение готовых задач. Возвращает число выполненных задач.
+            size_t WaitAndRun(int maxWaitMs = -1);
+            using TLoop::WaitAndRun;        // Сон через sleepUntil, без событий
+            void Wakeup();
+        protected:
+            // Submit() из другого потока сразу будит epoll_wait
+            void OnSubmit() override;
+        private:
+            struct TWatch {
+                TCallable task;
+                TStat stat;
+                bool active = false;
+            };
+
+            bool IsWatched(int fd) const;
+            int WaitTimeout(int maxWaitMs);
+
+            int epollFd;
+            TEventFd wakeup;
+            // Индекс - номер дескриптора. Записи не удаляются, поэтому адреса
+            // стабильны, пока задача выполняется
+            std::vector<std::unique_ptr<TWatch>> watches;
+            size_t watchCount;
+    };
+
+    inline TEpollLoop::TEpollLoop(size_t count, TLog& log, TDispatchPolicy policy)
+        : TLoop(count, log, policy)
+        , epollFd(epoll_create1(EPOLL_CLOEXEC))
+        , watchCount(0) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = wakeup.GetFd();
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeup.GetFd(), &event);
+    }
+    inline TEpollLoop::~TEpollLoop() {
+        if (epollFd >= 0)
+            close(epollFd);
+    }
+    inline bool TEpollLoop::Watch(int fd, uint32_t events, const TCallable& task) {
+        if (fd < 0 || fd == wakeup.GetFd())
+            return false;
+        if (static_cast<size_t>(fd) >= watches.size())
+            watches.resize(fd + 1);
+        if (!watches[fd])
+            watches[fd].reset(new TWatch());
+        TWatch& watch = *watches[fd];
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, watch.active ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) != 0)
+            return false;
+        if (!watch.active) {
+            watch.stat = TStat();
+            watchCount++;
+        }
+        watch.task = task;
+        watch.active = true;
+        return true;
+    }
+    inline bool TEpollLoop::Unwatch(int fd) {
+        if (!IsWatched(fd))
+            return false;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        watches[fd]->task = TCallable();
+        watches[fd]->active = false;
+        watchCount--;
+        return true;
+    }
+    inline bool TEpollLoop::IsWatched(int fd) const {
+        return fd >= 0 && static_cast<size_t>(fd) < watches.size() && watches[fd] && watches[fd]->active;
+    }
+    inline size_t TEpollLoop::GetWatchCount() const {
+        return watchCount;
+    }
+    inline TStat* TEpollLoop::GetStat(int fd) {
+        if (!IsWatched(fd))
+            return nullptr;
+        return &watches[fd]->stat;
+    }
+    inline void TEpollLoop::OnSubmit() {
+        Wakeup();
+    }
+    inline void TEpollLoop::Wakeup() {
+        wakeup.Notify();
+    }
+    inline int TEpollLoop::WaitTimeout(int maxWaitMs) {
+        tick_t wakeTime = NextWakeTime();
+        if (Sources() == 0)
+            return maxWaitMs;
+        tick_t tm = TTimer::GetTime();
+        if (!TimeAfter(wakeTime, tm))
+            return 0;
+        // Округляем вверх, чтобы не проснуться раньше срока и не крутиться вхолостую
+        uint64_t ms = (static_cast<uint64_t>(static_cast<tick_t>(wakeTime - tm)) * MTLOOP_TICK_NS + 999999) / 1000000;
+        if (maxWaitMs >= 0 && ms > static_cast<uint64_t>(maxWaitMs))
+            return maxWaitMs;
+        return ms > 0x7FFFFFFF ? 0x7FFFFFFF : static_cast<int>(ms);
+    }
+    inline size_t TEpollLoop::WaitAndRun(int maxWaitMs) {
+        int timeout = WaitTimeout(maxWaitMs);
+        epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        size_t done = 0;
+        tick_t tm = TTimer::GetTime();
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakeup.GetFd()) {
+                wakeup.Drain();
+                continue;
+            }
+            // Дескриптор мог быть отвязан задачей, выполненной раньше в этом же цикле
+            if (!IsWatched(fd))
+                continue;
+            TWatch& watch = *watches[fd];
+            // Задача может отвязать сама себя. Копия держит задачу живой до конца
+            // вызова: маленькая копируется целиком, у задачи по указателю растет
+            // счетчик ссылок
+            TCallable task = watch.task;
+            TraceChain(TRACE_FD_CHAIN);
+            TraceSlot(fd);
+            if (ExecuteTask(task, watch.stat, log, tm, tm)) {
+                done++;
+                tm = watch.stat.GetStopTime();
+            }
+        }
+        return done + RunUntilIdle();
+    }
+
+}
@@ -0,0 +1,69 @@
+/*
+ * MTLogThread.h
+ * Фоновый поток вывода отложенного лога для платформ с std::thread (Linux)
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace MT {
+
+    // ///////////////////////// //
+    //        TLogThread         //
+    // ///////////////////////// //
+    // Раз в period форматирует накопленные в TDeferredLog записи и передает их
+    // в sink. Поток планировщика только пишет в кольцо и не ждет вывода.
+    // Деструктор останавливает поток и выводит остаток.
+    class TLogThread {
+        public:
+            TLogThread(TDeferredLog& log, TLog& sink, std::chrono::microseconds period = std::chrono::milliseconds(10));
+            ~TLogThread();
+            void Stop();
+        private:
+            void Worker();
+
+            TDeferredLog& log;
+            TLog& sink;
+            std::chrono::microseconds period;
+            std::mutex mutex;
+            std::condition_variable wake;
+            bool stop;
+            std::thread thread;
+    };
+
+    inline TLogThread::TLogThread(TDeferredLog& log, TLog& sink, std::chrono::microseconds period)
+        : log(log)
+        , sink(sink)
+        , period(period)
+        , stop(false)
+        , thread(&TLogThread::Worker, this) {
+    }
+    inline TLogThread::~TLogThread() {
+        Stop();
+    }
+    inline void TLogThread::Stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        if (thread.joinable())
+            thread.join();
+        log.Flush(sink);
+    }
+    inline void TLogThread::Worker() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop) {
+            wake.wait_for(lock, period);
+            lock.unlock();
+            log.Flush(sink);
+            lock.lock();
+        }
+    }
+
+}
@@ -7,63 +7,277 @@
 #include <stddef.h>
 #include <inttypes.h>
 #include <initializer_list> // Custom initializer_list for AVR
+#ifdef ARDUINO_ARCH_AVR
+#include <new.h>
+#include <util/atomic.h>
+#else
+#include <new>
+#endif
+#ifdef MTLOOP_MOCK_TIMER
+#include <atomic>
+#endif
+#ifdef __linux__
+#include <time.h>
+#include <errno.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+#endif
 
 namespace MT {
 
+    // Разрядность тиков таймера: 16, 32 или 64. 64-битный счетчик микросекунд
+    // практически не переполняется, 16-битный экономит память на AVR.
+#ifndef MTLOOP_TICK_BITS
+#define MTLOOP_TICK_BITS 32
+#endif
+#if MTLOOP_TICK_BITS == 16
+    using tick_t = uint16_t;
+    using stick_t = int16_t;
+#elif MTLOOP_TICK_BITS == 32
     using tick_t = uint32_t;
+    using stick_t = int32_t;
+#elif MTLOOP_TICK_BITS == 64
+    using tick_t = uint64_t;
+    using stick_t = int64_t;
+#else
+#error "MTLOOP_TICK_BITS must be 16, 32 or 64"
+#endif
+
+    // Сравнение моментов времени с учетом переполнения счетчика. Верно, пока
+    // моменты отстоят друг от друга меньше чем на половину диапазона tick_t.
+    inline bool TimeBefore(tick_t a, tick_t b) {
+        return static_cast<stick_t>(static_cast<tick_t>(a - b)) < 0;
+    }
+    inline bool TimeAfter(tick_t a, tick_t b) {
+        return TimeBefore(b, a);
+    }
 
     const tick_t DEFAULT_SLOT_MIN_DURATION = 100;
     const tick_t DEFAULT_SLOT_PADDING = 0;
     const size_t DEFAULT_SLOT_CHAIN_COUNT = 10;
 
+    enum TDispatchPolicy {
+        DISPATCH_ROUND_ROBIN,   // Цепочки опрашиваются по кругу (по умолчанию)
+        DISPATCH_DEADLINE,      // Первой запускается самая просроченная цепочка
+        DISPATCH_PRIORITY       // Первой запускается готовая цепочка старшего класса
+                                // приоритета, внутри класса - самая просроченная
+    };
+    const uint8_t DEFAULT_CHAIN_PRIORITY = 0;
+
+    // Поведение цепочки, когда задача выходит за границу тайм-слота
+    enum TOverrunPolicy {
+        OVERRUN_STRETCH,        // Тайм-слот растягивается, расписание сдвигается
+        OVERRUN_LOG,            // Как OVERRUN_STRETCH, плюс запись в TLog
+        OVERRUN_COMPRESS,       // Следующие тайм-слоты сжимаются до плановой сетки
+        OVERRUN_SKIP_NEXT       // Тайм-слоты, окно которых уже прошло, пропускаются
+    };
+
+    // ///////////////////////// //
+    //      Таймеры Linux        //
+    // ///////////////////////// //
+    // Время отсчитывается от первого обращения к таймеру, один тик -
+    // MTLOOP_TICK_NS наносекунд (по умолчанию микросекунда, как micros()).
+#ifdef __linux__
+#ifndef MTLOOP_TICK_NS
+#define MTLOOP_TICK_NS 1000
+#endif
+    inline void SleepNs(uint64_t ns) {
+        timespec ts;
+        ts.tv_sec = ns / 1000000000u;
+        ts.tv_nsec = ns % 1000000000u;
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+
+    // Часы clock_gettime: CLOCK_MONOTONIC подстраивается NTP по частоте,
+    // CLOCK_MONOTONIC_RAW идет от кварца без подстройки
+    template<clockid_t CLOCK>
+    class TClockTimer {
+        public:
+            static tick_t GetTime();
+            static void SleepUntil(tick_t tm);
+            static uint64_t GetNs();    // Наносекунды от первого обращения
+        private:
+            static uint64_t ReadNs();
+    };
+
+    template<clockid_t CLOCK>
+    inline uint64_t TClockTimer<CLOCK>::ReadNs() {
+        timespec ts;
+        clock_gettime(CLOCK, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+    }
+    template<clockid_t CLOCK>
+    inline uint64_t TClockTimer<CLOCK>::GetNs() {
+        static const uint64_t epoch = ReadNs();
+        return ReadNs() - epoch;
+    }
+    template<clockid_t CLOCK>
+    inline tick_t TClockTimer<CLOCK>::GetTime() {
+        return static_cast<tick_t>(GetNs() / MTLOOP_TICK_NS);
+    }
+    template<clockid_t CLOCK>
+    inline void TClockTimer<CLOCK>::SleepUntil(tick_t tm) {
+        tick_t now = GetTime();
+        if (TimeBefore(now, tm))
+            SleepNs(static_cast<uint64_t>(static_cast<tick_t>(tm - now)) * MTLOOP_TICK_NS);
+    }
+
+    using TMonotonicTimer = TClockTimer<CLOCK_MONOTONIC>;
+    using TMonotonicRawTimer = TClockTimer<CLOCK_MONOTONIC_RAW>;
+
+#ifdef __x86_64__
+    // Счетчик тактов процессора (rdtsc) - самое дешевое чтение времени.
+    // Нужен TSC с постоянной частотой (флаги constant_tsc и nonstop_tsc в
+    // /proc/cpuinfo). Частота калибруется по CLOCK_MONOTONIC_RAW при первом
+    // обращении, калибровка занимает CALIBRATION_NS.
+    class TTscTimer {
+        public:
+            static const uint64_t CALIBRATION_NS = 10000000;
+
+            static tick_t GetTime();
+            static void SleepUntil(tick_t tm);
+            static uint64_t GetNs();    // Наносекунды от первого обращения
+            static double GetFrequency();   // Тактов в секунду
+        private:
+            struct TCalibration {
+                uint64_t base;          // Такты при калибровке
+                uint64_t nsMult;        // Наносекунды на такт, фиксированная точка 32.32
+                uint64_t tickMult;      // Тики на такт, фиксированная точка 32.32
+            };
+
+            static const TCalibration& Calibration();
+            static TCalibration Calibrate();
+    };
+
+    inline TTscTimer::TCalibration TTscTimer::Calibrate() {
+        uint64_t ns0 = TMonotonicRawTimer::GetNs();
+        uint64_t tsc0 = __rdtsc();
+        uint64_t ns1;
+        do {
+            ns1 = TMonotonicRawTimer::GetNs();
+        } while (ns1 - ns0 < CALIBRATION_NS);
+        uint64_t tsc1 = __rdtsc();
+        TCalibration calibration;
+        calibration.base = tsc0;
+        unsigned __int128 ns = static_cast<unsigned __int128>(ns1 - ns0) << 32;
+        calibration.nsMult = static_cast<uint64_t>(ns / (tsc1 - tsc0));
+        calibration.tickMult = static_cast<uint64_t>(ns / (static_cast<unsigned __int128>(tsc1 - tsc0) * MTLOOP_TICK_NS));
+        return calibration;
+    }
+    inline const TTscTimer::TCalibration& TTscTimer::Calibration() {
+        static const TCalibration calibration = Calibrate();
+        return calibration;
+    }
+    inline uint64_t TTscTimer::GetNs() {
+        const TCalibration& calibration = Calibration();
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(__rdtsc() - calibration.base) * calibration.nsMult) >> 32);
+    }
+    inline tick_t TTscTimer::GetTime() {
+        const TCalibration& calibration = Calibration();
+        return static_cast<tick_t>((static_cast<unsigned __int128>(__rdtsc() - calibration.base) * calibration.tickMult) >> 32);
+    }
+    inline void TTscTimer::SleepUntil(tick_t tm) {
+        tick_t now = GetTime();
+        if (TimeBefore(now, tm))
+            SleepNs(static_cast<uint64_t>(static_cast<tick_t>(tm - now)) * MTLOOP_TICK_NS);
+    }
+    inline double TTscTimer::GetFrequency() {
+        return 1e9 * 4294967296.0 / Calibration().nsMult;
+    }
+#endif
+#endif
+
+
     // ///////////////////////// //
     //         TTimer            //
     // ///////////////////////// //
+    // Источник времени выбирается при компиляции:
+    //   MTLOOP_MOCK_TIMER          - время задается тестом
+    //   MTLOOP_DUMMY_TIMER         - TTimer определяет пользователь
+    //   MTLOOP_TSC_TIMER           - TTscTimer (Linux, x86-64)
+    //   MTLOOP_MONOTONIC_RAW_TIMER - TMonotonicRawTimer (Linux)
+    //   MTLOOP_MONOTONIC_TIMER     - TMonotonicTimer, по умолчанию на Linux
 #ifdef MTLOOP_MOCK_TIMER
+    // Мок-время читают и рабочие потоки TParallelLoop
     class TTimer {
         public:
-            static tick_t time;
-            static tick_t increment;
+            static std::atomic<tick_t> time;
+            static std::atomic<tick_t> increment;
 
             static tick_t GetTime();
+            static void SleepUntil(tick_t tm);
     };
 
-    tick_t TTimer::time = 1;
-    tick_t TTimer::increment = 0;
+    std::atomic<tick_t> TTimer::time(1);
+    std::atomic<tick_t> TTimer::increment(0);
 
     inline tick_t TTimer::GetTime() {
-        tick_t t = time;
-        time += increment;
-        return t;
+        tick_t inc = increment.load(std::memory_order_relaxed);
+        if (inc == 0)
+            return time.load(std::memory_order_relaxed);
+        return time.fetch_add(inc, std::memory_order_relaxed);
+    }
+    inline void TTimer::SleepUntil(tick_t tm) {
+        if (TimeBefore(time, tm))
+            time = tm;
     }
 
 #elif MTLOOP_DUMMY_TIMER
+#elif defined(MTLOOP_TSC_TIMER)
+    using TTimer = TTscTimer;
+#elif defined(MTLOOP_MONOTONIC_RAW_TIMER)
+    using TTimer = TMonotonicRawTimer;
+#elif defined(MTLOOP_MONOTONIC_TIMER) || defined(__linux__)
+    using TTimer = TMonotonicTimer;
 #else
     class TTimer {
         public:
             static tick_t GetTime();
+            static void SleepUntil(tick_t tm);
         private:
     };
 
     inline tick_t TTimer::GetTime() {
         return 1;
     }
+    inline void TTimer::SleepUntil(tick_t tm) {
+    }
 #endif
 
 
     // ///////////////////////// //
     //         TLog              //
     // ///////////////////////// //
+    // Уровни логирования. Вызовы Write<Level> с уровнем выше MTLOOP_LOG_LEVEL
+    // исчезают при компиляции вместе с виртуальным вызовом Log.
+    enum TLogLevel {
+        LOG_ERROR = 1,
+        LOG_WARNING,
+        LOG_INFO,
+        LOG_DEBUG
+    };
+#ifndef MTLOOP_LOG_LEVEL
+#define MTLOOP_LOG_LEVEL 3      // LOG_INFO; 0 - логирование выключено
+#endif
+
     class TLog {
         public:
             TLog() = default;
             virtual ~TLog() = default;
             void virtual Log(const char* logLine);
+            template<TLogLevel Level> void Write(const char* logLine);
         private:
     };
 
     inline void TLog::Log(const char* logLine) {
     }
+    template<TLogLevel Level>
+    inline void TLog::Write(const char* logLine) {
+        if (Level <= MTLOOP_LOG_LEVEL)
+            Log(logLine);
+    }
 
 
     // ///////////////////////// //
@@ -76,6 +290,116 @@ namespace MT {
     };
 
 
+    // ///////////////////////// //
+    //        THistogram         //
+    // ///////////////////////// //
+    // Гистограмма с логарифмическими корзинами в духе HDR Histogram: значения
+    // меньше 2^SUB_BITS считаются точно, остальные - с относительной точностью
+    // 2^-SUB_BITS. Память фиксирована, но велика: при 64-битном tick_t две
+    // гистограммы добавляют к TStat каждого тайм-слота около килобайта, поэтому
+    // по умолчанию отключены (MTLOOP_STAT_HISTOGRAM=1 включает).
+#ifndef MTLOOP_STAT_HISTOGRAM
+#define MTLOOP_STAT_HISTOGRAM 0
+#endif
+#ifndef MTLOOP_HISTOGRAM_SUB_BITS
+#define MTLOOP_HISTOGRAM_SUB_BITS 2
+#endif
+#if MTLOOP_STAT_HISTOGRAM
+    class THistogram {
+        public:
+            static const unsigned SUB_BITS = MTLOOP_HISTOGRAM_SUB_BITS;
+            static const size_t SUB_COUNT = size_t(1) << SUB_BITS;
+            static const size_t BUCKETS = (sizeof(tick_t) * 8 - SUB_BITS + 1) * SUB_COUNT;
+
+            THistogram();
+            void Record(tick_t value);
+            void Reset();
+            uint32_t GetCount() const;
+            tick_t GetMin() const;
+            tick_t GetMax() const;
+            double GetMean() const;
+            tick_t GetPercentile(double percent) const;    // Верхняя граница корзины
+            uint32_t GetBucketCount(size_t bucket) const;
+            static size_t BucketOf(tick_t value);
+            static tick_t BucketLow(size_t bucket);
+            static tick_t BucketHigh(size_t bucket);
+        private:
+            uint32_t counts[BUCKETS];
+            uint32_t count;
+            tick_t min;
+            tick_t max;
+            uint64_t sum;
+    };
+
+    inline THistogram::THistogram() {
+        Reset();
+    }
+    inline void THistogram::Reset() {
+        for (size_t i = 0; i < BUCKETS; ++i)
+            counts[i] = 0;
+        count = 0;
+        min = 0;
+        max = 0;
+        sum = 0;
+    }
+    inline size_t THistogram::BucketOf(tick_t value) {
+        if (value < SUB_COUNT)
+            return value;
+        unsigned msb = 63 - __builtin_clzll(static_cast<unsigned long long>(value));
+        unsigned shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + ((value >> shift) - SUB_COUNT);
+    }
+    inline tick_t THistogram::BucketLow(size_t bucket) {
+        if (bucket < SUB_COUNT)
+            return bucket;
+        unsigned shift = bucket / SUB_COUNT - 1;
+        return static_cast<tick_t>(SUB_COUNT + bucket % SUB_COUNT) << shift;
+    }
+    inline tick_t THistogram::BucketHigh(size_t bucket) {
+        if (bucket < SUB_COUNT)
+            return bucket;
+        unsigned shift = bucket / SUB_COUNT - 1;
+        return BucketLow(bucket) + ((static_cast<tick_t>(1) << shift) - 1);
+    }
+    inline void THistogram::Record(tick_t value) {
+        counts[BucketOf(value)]++;
+        if (count == 0 || value < min)
+            min = value;
+        if (count == 0 || value > max)
+            max = value;
+        count++;
+        sum += value;
+    }
+    inline uint32_t THistogram::GetCount() const {
+        return count;
+    }
+    inline tick_t THistogram::GetMin() const {
+        return min;
+    }
+    inline tick_t THistogram::GetMax() const {
+        return max;
+    }
+    inline double THistogram::GetMean() const {
+        return count > 0 ? static_cast<double>(sum) / count : 0;
+    }
+    inline tick_t THistogram::GetPercentile(double percent) const {
+        if (count == 0)
+            return 0;
+        double target = count * percent / 100;
+        uint32_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (counts[i] > 0 && seen >= target)
+                return BucketHigh(i) < max ? BucketHigh(i) : max;
+        }
+        return max;
+    }
+    inline uint32_t THistogram::GetBucketCount(size_t bucket) const {
+        return counts[bucket];
+    }
+#endif
+
+
     // ///////////////////////// //
     //         TStat             //
     // ///////////////////////// //
@@ -89,26 +413,83 @@ namespace MT {
             tick_t GetStartTime();
             tick_t GetStopTime();
             tick_t GetDuration();
+            // Учет выполнения, начавшегося в startTime при плановом начале plannedTime
+            void Sample(tick_t plannedTime);
+            void AddOverrun();
+            void AddSkip();
+            uint32_t GetOverrunCount() const;
+            uint32_t GetSkipCount() const;
+#if MTLOOP_STAT_HISTOGRAM
+            THistogram& GetDurationHistogram();
+            THistogram& GetLatenessHistogram();
+#endif
         private:
             tick_t startTime;
             tick_t stopTime;
+            uint32_t overruns;      // Выполнения дольше бюджета тайм-слота
+            uint32_t skips;         // Пропущенные по OVERRUN_SKIP_NEXT выполнения
+#if MTLOOP_STAT_HISTOGRAM
+            THistogram duration;
+            THistogram lateness;
+#endif
     };
  
     inline TStat::TStat()
             : startTime(0)
-            , stopTime(0) {
+            , stopTime(0)
+            , overruns(0)
+            , skips(0) {
     }
     inline TStat::TStat(const TStat& stat)
             : startTime(stat.startTime)
-            , stopTime(stat.stopTime) {
+            , stopTime(stat.stopTime)
+            , overruns(stat.overruns)
+            , skips(stat.skips)
+#if MTLOOP_STAT_HISTOGRAM
+            , duration(stat.duration)
+            , lateness(stat.lateness)
+#endif
+            {
     }
     inline TStat& TStat::operator=(const TStat& a) {
         if(this != &a) {
             startTime = a.startTime;
             stopTime = a.stopTime;
+            overruns = a.overruns;
+            skips = a.skips;
+#if MTLOOP_STAT_HISTOGRAM
+            duration = a.duration;
+            lateness = a.lateness;
+#endif
         }
         return *this;
     }
+    inline void TStat::Sample(tick_t plannedTime) {
+#if MTLOOP_STAT_HISTOGRAM
+        duration.Record(stopTime - startTime);
+        lateness.Record(TimeAfter(startTime, plannedTime) ? startTime - plannedTime : 0);
+#endif
+    }
+    inline void TStat::AddOverrun() {
+        overruns++;
+    }
+    inline void TStat::AddSkip() {
+        skips++;
+    }
+    inline uint32_t TStat::GetOverrunCount() const {
+        return overruns;
+    }
+    inline uint32_t TStat::GetSkipCount() const {
+        return skips;
+    }
+#if MTLOOP_STAT_HISTOGRAM
+    inline THistogram& TStat::GetDurationHistogram() {
+        return duration;
+    }
+    inline THistogram& TStat::GetLatenessHistogram() {
+        return lateness;
+    }
+#endif
     inline void TStat::SetStartTime(tick_t tm) {
         startTime = tm;
     }
@@ -127,56 +508,273 @@ namespace MT {
 
 
     // ///////////////////////// //
-    //         IAdapter          //
+    //         SlotRTime         //
+    // ///////////////////////// //
+    // Правая граница тайм-слота, начавшегося в slotStartTime, на момент tm.
+    // executed - задача уже выполнилась в этом тайм-слоте и закончилась в stopTime.
+    // Общее правило для TTimeSlot, TStaticChain и TPackedChain.
+    inline tick_t SlotRTime(tick_t tm, tick_t slotStartTime, tick_t minDuration, tick_t padding, bool executed, tick_t stopTime) {
+        tick_t rTime = slotStartTime + minDuration - 1;
+        if (executed) {
+            tick_t taskStopTimeWithPadding = stopTime + padding;
+            if (TimeBefore(rTime, taskStopTimeWithPadding))
+                rTime = taskStopTimeWithPadding;
+        } else if (TimeAfter(tm, rTime)) {
+            rTime = tm + padding;
+        }
+        return rTime;
+    }
+
+
+    // ///////////////////////// //
+    //          TTrace           //
     // ///////////////////////// //
-    class IAdapter: public TStat, public IRunnable {
+    // Журнал выполнений тайм-слотов в кольцевом буфере: цепочка, тайм-слот,
+    // плановое и фактическое начало, окончание и результат задачи. Включается
+    // MTLOOP_TRACE=1; без него точки записи пустые и буфер не создается.
+    // Запись - захват позиции одним атомарным сложением и несколько сохранений,
+    // старые события вытесняются новыми. Читать буфер нужно, когда
+    // планировщик стоит, иначе событие может попасть в дамп наполовину.
+#ifndef MTLOOP_TRACE
+#define MTLOOP_TRACE 0
+#endif
+#ifndef MTLOOP_TRACE_SIZE
+#define MTLOOP_TRACE_SIZE 256
+#endif
+    const uint16_t TRACE_TIMER_CHAIN = 0xFFFF;  // Разовые задачи TTimerWheel, slot - номер таймера
+    const uint16_t TRACE_FD_CHAIN = 0xFFFE;     // Задачи дескрипторов TEpollLoop, slot - дескриптор
+    const uint8_t TRACE_DUMP_VERSION = 1;
+
+    struct TTraceEvent {
+        tick_t planned;     // Начало тайм-слота
+        tick_t start;
+        tick_t stop;
+        uint16_t chain;     // Номер цепочки в планировщике
+        uint16_t slot;      // Номер тайм-слота в цепочке
+        uint8_t result;     // Задача вернула true
+    };
+
+    class TTraceBuffer {
         public:
-            virtual IAdapter* Clone() const = 0;
-            virtual ~IAdapter() = default;
-            bool Execute(TLog& log);
+            static constexpr size_t SIZE = MTLOOP_TRACE_SIZE;
+            static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "MTLOOP_TRACE_SIZE must be a power of two");
+
+            TTraceBuffer();
+            void Record(uint16_t chain, uint16_t slot, tick_t planned, tick_t start, tick_t stop, bool result);
+            void Reset();
+            uint32_t GetRecorded() const;               // Всего записано, с вытесненными
+            size_t GetSize() const;                     // Событий в буфере
+            const TTraceEvent& At(size_t i) const;      // От старых к новым
+            // Переносимый дамп для MTTrace.h, побайтно: на Arduino - в Serial.write
+            template<typename TWrite> void Dump(TWrite write) const;
+        private:
+            template<typename TWrite> static void WriteLE(TWrite& write, uint64_t value, size_t bytes);
+
+            TTraceEvent events[SIZE];
+            uint32_t head;
     };
 
-    inline bool IAdapter::Execute(TLog& log) {
-        tick_t tm = TTimer::GetTime();
-        if (Run(log)) {
-            SetStartTime(tm);
-            SetStopTime(TTimer::GetTime());
-            return true;
+    inline TTraceBuffer::TTraceBuffer()
+        : head(0) {
+    }
+    inline void TTraceBuffer::Record(uint16_t chain, uint16_t slot, tick_t planned, tick_t start, tick_t stop, bool result) {
+        // Один писатель: поток планировщика. Прерывания сюда не пишут, рабочие
+        // потоки TParallelLoop журнал отключают (TraceThreadOff)
+        TTraceEvent& event = events[head++ & (SIZE - 1)];
+        event.planned = planned;
+        event.start = start;
+        event.stop = stop;
+        event.chain = chain;
+        event.slot = slot;
+        event.result = result;
+    }
+    inline void TTraceBuffer::Reset() {
+        head = 0;
+    }
+    inline uint32_t TTraceBuffer::GetRecorded() const {
+        return head;
+    }
+    inline size_t TTraceBuffer::GetSize() const {
+        return head < SIZE ? head : SIZE;
+    }
+    inline const TTraceEvent& TTraceBuffer::At(size_t i) const {
+        return events[(head - GetSize() + i) & (SIZE - 1)];
+    }
+    template<typename TWrite>
+    inline void TTraceBuffer::WriteLE(TWrite& write, uint64_t value, size_t bytes) {
+        for (size_t i = 0; i < bytes; ++i)
+            write(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    template<typename TWrite>
+    inline void TTraceBuffer::Dump(TWrite write) const {
+        // Заголовок: "MTTR", версия, байт в tick_t, событий в дампе, записано всего.
+        // Событие: chain, slot, result, planned, start, stop - little-endian.
+        write('M');
+        write('T');
+        write('T');
+        write('R');
+        write(TRACE_DUMP_VERSION);
+        write(static_cast<uint8_t>(sizeof(tick_t)));
+        size_t size = GetSize();
+        WriteLE(write, size, 4);
+        WriteLE(write, head, 4);
+        for (size_t i = 0; i < size; ++i) {
+            const TTraceEvent& event = At(i);
+            WriteLE(write, event.chain, 2);
+            WriteLE(write, event.slot, 2);
+            write(event.result);
+            WriteLE(write, event.planned, sizeof(tick_t));
+            WriteLE(write, event.start, sizeof(tick_t));
+            WriteLE(write, event.stop, sizeof(tick_t));
         }
-        return false;
     }
 
+    inline TTraceBuffer& TraceBuffer() {
+        static TTraceBuffer buffer;
+        return buffer;
+    }
+
+    // Точки записи. Номер цепочки задает планировщик, номер тайм-слота -
+    // цепочка, событие пишет ExecuteTask. Контекст свой у каждого потока.
+    struct TTraceContext {
+        uint16_t chain;
+        uint16_t slot;
+        bool off;       // Поток не пишет в TraceBuffer()
+    };
+#if MTLOOP_TRACE
+    inline TTraceContext& TraceContext() {
+#ifdef ARDUINO_ARCH_AVR
+        static TTraceContext context;
+#else
+        static thread_local TTraceContext context;
+#endif
+        return context;
+    }
+#endif
+    inline void TraceChain(size_t chain) {
+#if MTLOOP_TRACE
+        TraceContext().chain = static_cast<uint16_t>(chain);
+#endif
+    }
+    inline void TraceSlot(size_t slot) {
+#if MTLOOP_TRACE
+        TraceContext().slot = static_cast<uint16_t>(slot);
+#endif
+    }
+    inline void TraceExecution(tick_t planned, tick_t start, tick_t stop, bool result) {
+#if MTLOOP_TRACE
+        TTraceContext& context = TraceContext();
+        if (!context.off)
+            TraceBuffer().Record(context.chain, context.slot, planned, start, stop, result);
+#endif
+    }
+    // Отключает журнал в текущем потоке: у TraceBuffer() один писатель
+    inline void TraceThreadOff() {
+#if MTLOOP_TRACE
+        TraceContext().off = true;
+#endif
+    }
+    // Отказ задачи: окончание читается только при включенном журнале
+    inline void TraceDecline(tick_t planned, tick_t start) {
+#if MTLOOP_TRACE
+        TraceExecution(planned, start, TTimer::GetTime(), false);
+#endif
+    }
+
+
+    // ///////////////////////// //
+    //         TCallable         //
+    // ///////////////////////// //
+#ifndef MTLOOP_CALLABLE_WORDS
+#define MTLOOP_CALLABLE_WORDS 3
+#endif
+    const size_t CALLABLE_STORAGE_SIZE = MTLOOP_CALLABLE_WORDS * sizeof(void*);
+
+    // Замена std::enable_if, std::is_same и проверка "F - задача IRunnable или указатель на нее"
+    template<bool Cond, typename T = void> struct TEnableIf { };
+    template<typename T> struct TEnableIf<true, T> { using type = T; };
+
+    template<typename A, typename B> struct TIsSame { static const bool value = false; };
+    template<typename A> struct TIsSame<A, A> { static const bool value = true; };
+
+    template<typename F>
+    struct TIsRunnable {
+        static char Test(const volatile IRunnable*);
+        static long Test(...);
+        static F& Make();
+        static const bool value =
+            sizeof(Test(&Make())) == sizeof(char) || sizeof(Test(Make())) == sizeof(char);
+    };
+
+    struct alignas(void*) alignas(uint64_t) TCallableStorage {
+        unsigned char data[CALLABLE_STORAGE_SIZE];
+    };
+
+    // Задача, хранящаяся по значению: функция, лямбда (в том числе с захватом),
+    // функтор или IRunnable. Объект до CALLABLE_STORAGE_SIZE байт размещается
+    // внутри TCallable, больший - в куче. Вызов задачи - один косвенный вызов.
+    class TCallable {
+        public:
+            TCallable();
+            TCallable(IRunnable& task);
+            TCallable(IRunnable* task);
+            template<typename F, typename = typename TEnableIf<
+                !TIsRunnable<F>::value && !TIsSame<F, TCallable>::value>::type>
+            TCallable(F f);
+            TCallable(const TCallable& c);
+            ~TCallable();
+            TCallable& operator=(const TCallable& c);
+            bool operator()(TLog& log);
+        private:
+            struct TNopTask {
+                bool operator()(TLog&) {
+                    return true;
+                }
+            };
+            template<bool Inline> struct TPlacement { };
+            template<typename R> struct TResult { };
+            template<typename F> void Init(const F& f);
+            template<typename F> void Init(const F& f, TPlacement<true>);
+            template<typename F> void Init(const F& f, TPlacement<false>);
+
+            // Задача F может иметь вид bool(TLog&), void(TLog&) или void();
+            // задача без результата считается выполненной
+            template<typename F>
+            static auto Call(F& f, TLog& log, int) -> decltype(f(log), bool());
+            template<typename F>
+            static bool Call(F& f, TLog& log, long);
+            template<typename F, typename R>
+            static bool CallResult(F& f, TLog& log, TResult<R>);
+            template<typename F>
+            static bool CallResult(F& f, TLog& log, TResult<void>);
+
+            template<typename F> static bool InvokeInline(TCallableStorage& s, TLog& log);
+            template<typename F> static bool InvokeHeap(TCallableStorage& s, TLog& log);
+            // dst == nullptr - разрушить src, иначе - скопировать src в dst
+            template<typename F> static void ManageInline(TCallableStorage* dst, const TCallableStorage& src);
+            template<typename F> static void ManageHeap(TCallableStorage* dst, const TCallableStorage& src);
+
+            bool (*invoke)(TCallableStorage& s, TLog& log);
+            void (*manage)(TCallableStorage* dst, const TCallableStorage& src);
+            TCallableStorage storage;
+    };
+
 
     // ///////////////////////// //
     //         TCbAdapter        //
     // ///////////////////////// //
     using callbackPtr = bool(*)(TLog& log);
-    class TCbAdapter: public IAdapter {
+    class TCbAdapter {
         public:
             TCbAdapter(callbackPtr cb);
-            TCbAdapter(const TCbAdapter& ca);
-            IAdapter* Clone() const override;
-            TCbAdapter& operator=(const TCbAdapter& ts);
-            bool Run(TLog& log) override;
+            bool operator()(TLog& log);
         private:
             callbackPtr cb;
     };
 
-    inline TCbAdapter::TCbAdapter(callbackPtr cb): IAdapter(), cb(cb) {
-    }
-    inline TCbAdapter::TCbAdapter(const TCbAdapter& ca): IAdapter(ca), cb(ca.cb) {
+    inline TCbAdapter::TCbAdapter(callbackPtr cb): cb(cb) {
     }
-    inline IAdapter* TCbAdapter::Clone() const {
-        return new TCbAdapter{*this};
-    }
-    inline TCbAdapter& TCbAdapter::operator=(const TCbAdapter& a) {
-        if(this != &a) {
-            TStat::operator=(a);
-            cb = a.cb;
-        }
-        return *this;
-    }
-    inline bool TCbAdapter::Run(TLog& log) {
+    inline bool TCbAdapter::operator()(TLog& log) {
         return cb(log);
     }
 
@@ -185,32 +783,17 @@ namespace MT {
     //     TCbDummyAdapter       //
     // ///////////////////////// //
     using callbackDummyPtr = void(*)();
-    class TCbDummyAdapter: public IAdapter {
+    class TCbDummyAdapter {
         public:
             TCbDummyAdapter(callbackDummyPtr cbd);
-            TCbDummyAdapter(const TCbDummyAdapter& ca);
-            IAdapter* Clone() const override;
-            TCbDummyAdapter& operator=(const TCbDummyAdapter& ts);
-            bool Run(TLog& log) override;
+            bool operator()(TLog& log);
         private:
             callbackDummyPtr cbd;
     };
 
-    inline TCbDummyAdapter::TCbDummyAdapter(callbackDummyPtr cbd): IAdapter(), cbd(cbd) {
-    }
-    inline TCbDummyAdapter::TCbDummyAdapter(const TCbDummyAdapter& ca): IAdapter(ca), cbd(ca.cbd) {
-    }
-    inline IAdapter* TCbDummyAdapter::Clone() const {
-        return new TCbDummyAdapter{*this};
+    inline TCbDummyAdapter::TCbDummyAdapter(callbackDummyPtr cbd): cbd(cbd) {
     }
-    inline TCbDummyAdapter& TCbDummyAdapter::operator=(const TCbDummyAdapter& a) {
-        if(this != &a) {
-            TStat::operator=(a);
-            cbd = a.cbd;
-        }
-        return *this;
-    }
-    inline bool TCbDummyAdapter::Run(TLog& log) {
+    inline bool TCbDummyAdapter::operator()(TLog& log) {
         cbd();
         return true;
     }
@@ -219,217 +802,1786 @@ namespace MT {
     // ///////////////////////// //
     //         TTskAdapter       //
     // ///////////////////////// //
-    class TTskAdapter: public IAdapter {
+    class TTskAdapter {
         public:
             TTskAdapter(IRunnable& task);
-            TTskAdapter(const TTskAdapter& ta);
-            IAdapter* Clone() const override;
-            TTskAdapter& operator=(const TTskAdapter& ts);
-            bool Run(TLog& log) override;
+            bool operator()(TLog& log);
         private:
-            IRunnable& task;
+            IRunnable* task;
     };
 
-    inline TTskAdapter::TTskAdapter(IRunnable& task): IAdapter(), task(task) {
-    }
-    inline TTskAdapter::TTskAdapter(const TTskAdapter& ta): IAdapter(ta), task(ta.task) {
-    }
-    inline IAdapter* TTskAdapter::Clone() const {
-        return new TTskAdapter{*this};
+    inline TTskAdapter::TTskAdapter(IRunnable& task): task(&task) {
     }
-    inline TTskAdapter& TTskAdapter::operator=(const TTskAdapter& a) {
-        if(this != &a) {
-            TStat::operator=(a);
-            task = a.task;
-        }
-        return *this;
-    }
-    inline bool TTskAdapter::Run(TLog& log) {
-        return task.Run(log);
+    inline bool TTskAdapter::operator()(TLog& log) {
+        return task->Run(log);
     }
 
 
     // ///////////////////////// //
     //      TTskPtrAdapter       //
     // ///////////////////////// //
-    class TTskPtrAdapter: public IAdapter {
+    class TTskPtrAdapter {
         public:
             TTskPtrAdapter(IRunnable* task);
             TTskPtrAdapter(const TTskPtrAdapter& ta);
             ~TTskPtrAdapter();
-            IAdapter* Clone() const override;
             TTskPtrAdapter& operator=(const TTskPtrAdapter& ts);
-            bool Run(TLog& log) override;
+            bool operator()(TLog& log);
         private:
-            IRunnable* task;
+            // Задача общая для всех копий адаптера (копии TTimeSlot, сдвиги
+            // в TTimeSlotChain) и удаляется вместе с последней копией
+            struct TShared {
+                IRunnable* task;
+                size_t refs;
+            };
+            void Acquire();
+            void Release();
+
+            TShared* shared;
     };
 
-    inline TTskPtrAdapter::TTskPtrAdapter(IRunnable* task): IAdapter(), task(task) {
+    inline TTskPtrAdapter::TTskPtrAdapter(IRunnable* task): shared(new TShared { task, 1 }) {
     }
-    inline TTskPtrAdapter::TTskPtrAdapter(const TTskPtrAdapter& ta): IAdapter(ta), task(ta.task) {
+    inline TTskPtrAdapter::TTskPtrAdapter(const TTskPtrAdapter& ta): shared(ta.shared) {
+        Acquire();
     }
     inline TTskPtrAdapter::~TTskPtrAdapter() {
-        delete task;
-    }
-    inline IAdapter* TTskPtrAdapter::Clone() const {
-        return new TTskPtrAdapter{*this};
+        Release();
     }
     inline TTskPtrAdapter& TTskPtrAdapter::operator=(const TTskPtrAdapter& a) {
-        if(this != &a) {
-            TStat::operator=(a);
-            delete task;
-            task = a.task;
+        if(shared != a.shared) {
+            Release();
+            shared = a.shared;
+            Acquire();
         }
         return *this;
     }
-    inline bool TTskPtrAdapter::Run(TLog& log) {
-        return task->Run(log);
+    inline void TTskPtrAdapter::Acquire() {
+#ifdef ARDUINO_ARCH_AVR
+        shared->refs++;
+#else
+        // Копии могут разрушаться в рабочих потоках TParallelLoop
+        __atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
+#endif
+    }
+    inline void TTskPtrAdapter::Release() {
+#ifdef ARDUINO_ARCH_AVR
+        size_t refs = --shared->refs;
+#else
+        size_t refs = __atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL);
+#endif
+        if (refs == 0) {
+            delete shared->task;
+            delete shared;
+        }
+    }
+    inline bool TTskPtrAdapter::operator()(TLog& log) {
+        return shared->task->Run(log);
     }
 
 
     // ///////////////////////// //
-    //         TTimeSlot         //
+    //    TCallable (методы)     //
     // ///////////////////////// //
-    class TTimeSlot: public IRunnable {
-    public:
-        TTimeSlot(TCbAdapter ca, tick_t minDuration = DEFAULT_SLOT_MIN_DURATION, tick_t padding = DEFAULT_SLOT_PADDING);
-        TTimeSlot(TCbDummyAdapter ca, tick_t minDuration = DEFAULT_SLOT_MIN_DURATION, tick_t padding = DEFAULT_SLOT_PADDING);
-        TTimeSlot(TTskAdapter ta, tick_t minDuration = DEFAULT_SLOT_MIN_DURATION, tick_t padding = DEFAULT_SLOT_PADDING);
-        TTimeSlot(TTskPtrAdapter ta, tick_t minDuration = DEFAULT_SLOT_MIN_DURATION, tick_t padding = DEFAULT_SLOT_PADDING);
-        TTimeSlot(const TTimeSlot& ts);
-        virtual ~TTimeSlot();
-        TTimeSlot * Clone() const;
-        TTimeSlot& operator=(const TTimeSlot& ts);
-        bool Run(TLog& log) override;
-        void SetStartTime(tick_t time);
-        void SetMinDuration(tick_t time);
-        void SetPadding(tick_t time);
-        tick_t GetLTime();
-        tick_t GetRTime();
-    private:
-        IAdapter* task;
-        tick_t slotStartTime = 1;
-        tick_t minDuration;
-        tick_t padding;
-    };
-
-    inline TTimeSlot::TTimeSlot(TCbAdapter ca, tick_t minDuration, tick_t padding)
-        : task(ca.Clone())
-        , minDuration(minDuration)
-        , padding(padding) {
+    inline TCallable::TCallable() {
+        Init(TNopTask());
     }
-    inline TTimeSlot::TTimeSlot(TCbDummyAdapter ca, tick_t minDuration, tick_t padding)
-        : task(ca.Clone())
-        , minDuration(minDuration)
-        , padding(padding) {
+    inline TCallable::TCallable(IRunnable& task) {
+        Init(TTskAdapter(task));
     }
-    inline TTimeSlot::TTimeSlot(TTskAdapter ta, tick_t minDuration, tick_t padding)
-        : task(ta.Clone())
-        , minDuration(minDuration)
-        , padding(padding) {
+    inline TCallable::TCallable(IRunnable* task) {
+        Init(TTskPtrAdapter(task));
     }
-    inline TTimeSlot::TTimeSlot(TTskPtrAdapter ta, tick_t minDuration, tick_t padding)
-        : task(ta.Clone())
-        , minDuration(minDuration)
-        , padding(padding) {
+    template<typename F, typename>
+    inline TCallable::TCallable(F f) {
+        Init(f);
     }
-    inline TTimeSlot::TTimeSlot(const TTimeSlot& ts)
-        : task(ts.task->Clone())
-        , slotStartTime(ts.slotStartTime)
-        , minDuration(ts.minDuration)
-        , padding(ts.padding) {
+    inline TCallable::TCallable(const TCallable& c)
+        : invoke(c.invoke)
+        , manage(c.manage) {
+        manage(&storage, c.storage);
     }
-    inline TTimeSlot& TTimeSlot::operator=(const TTimeSlot& ts) {
-        if(this != &ts) {
-            delete task;
-            task = ts.task->Clone();
-            slotStartTime = ts.slotStartTime;
-            minDuration = ts.minDuration;
-            padding = ts.padding;
+    inline TCallable::~TCallable() {
+        manage(nullptr, storage);
+    }
+    inline TCallable& TCallable::operator=(const TCallable& c) {
+        if(this != &c) {
+            manage(nullptr, storage);
+            invoke = c.invoke;
+            manage = c.manage;
+            manage(&storage, c.storage);
         }
         return *this;
     }
-    inline TTimeSlot::~TTimeSlot() {
-        delete task;
+    inline bool TCallable::operator()(TLog& log) {
+        return invoke(storage, log);
     }
-    inline TTimeSlot * TTimeSlot::Clone() const {
-        return new TTimeSlot(*this);
+    template<typename F>
+    inline void TCallable::Init(const F& f) {
+        Init(f, TPlacement<sizeof(F) <= sizeof(TCallableStorage) && alignof(F) <= alignof(TCallableStorage)>());
     }
-    inline void TTimeSlot::SetStartTime(tick_t time) {
-        slotStartTime = time;
+    template<typename F>
+    inline void TCallable::Init(const F& f, TPlacement<true>) {
+        new (&storage) F(f);
+        invoke = &InvokeInline<F>;
+        manage = &ManageInline<F>;
     }
-    inline void TTimeSlot::SetMinDuration(tick_t time) {
-        minDuration = time;
+    template<typename F>
+    inline void TCallable::Init(const F& f, TPlacement<false>) {
+        new (&storage) F*(new F(f));
+        invoke = &InvokeHeap<F>;
+        manage = &ManageHeap<F>;
     }
-    inline void TTimeSlot::SetPadding(tick_t time) {
-        padding = time;
+    template<typename F>
+    inline auto TCallable::Call(F& f, TLog& log, int) -> decltype(f(log), bool()) {
+        return CallResult(f, log, TResult<decltype(f(log))>());
     }
-    inline bool TTimeSlot::Run(TLog& log) {
-        tick_t tm = TTimer::GetTime();
-        if (tm < slotStartTime)
-            return false;
-        if (task->GetStartTime() >= slotStartTime)
-            return true;
-        if (task->Execute(log))
-            return true;
-        return false;
+    template<typename F>
+    inline bool TCallable::Call(F& f, TLog& log, long) {
+        f();
+        return true;
     }
-    inline tick_t TTimeSlot::GetLTime() {
-        return slotStartTime;
+    template<typename F, typename R>
+    inline bool TCallable::CallResult(F& f, TLog& log, TResult<R>) {
+        return f(log);
     }
-    inline tick_t TTimeSlot::GetRTime() {
-        tick_t tm = TTimer::GetTime();
-        tick_t rTime = slotStartTime + minDuration;
-        if (rTime > 0)
-           rTime--;
-        if (task->GetStartTime() >= slotStartTime) {
-            tick_t taskStopTimeWithPadding = task->GetStopTime() + padding;
-            if (rTime < taskStopTimeWithPadding)
-                rTime = taskStopTimeWithPadding;
-        } else if (tm > rTime) {
-            rTime = tm + padding;
-        }
-        return rTime;
+    template<typename F>
+    inline bool TCallable::CallResult(F& f, TLog& log, TResult<void>) {
+        f(log);
+        return true;
+    }
+    template<typename F>
+    inline bool TCallable::InvokeInline(TCallableStorage& s, TLog& log) {
+        return Call(*reinterpret_cast<F*>(&s), log, 0);
+    }
+    template<typename F>
+    inline bool TCallable::InvokeHeap(TCallableStorage& s, TLog& log) {
+        return Call(**reinterpret_cast<F**>(&s), log, 0);
+    }
+    template<typename F>
+    inline void TCallable::ManageInline(TCallableStorage* dst, const TCallableStorage& src) {
+        if (dst == nullptr)
+            reinterpret_cast<F*>(const_cast<TCallableStorage*>(&src))->~F();
+        else
+            new (dst) F(*reinterpret_cast<const F*>(&src));
+    }
+    template<typename F>
+    inline void TCallable::ManageHeap(TCallableStorage* dst, const TCallableStorage& src) {
+        F* f = *reinterpret_cast<F* const*>(&src);
+        if (dst == nullptr)
+            delete f;
+        else
+            new (dst) F*(new F(*f));
     }
 
 
     // ///////////////////////// //
-    //      TTimeSlotChain       //
+    //        ExecuteTask        //
     // ///////////////////////// //
-    using TTimeSlotPtr = TTimeSlot *;
-    class TTimeSlotChain {
-        public:
-            TTimeSlotChain(const std::initializer_list<TTimeSlot>& ts);
+    // Запуск задачи с учетом в TStat - общий путь для тайм-слотов и таймеров.
+    // plannedTime - плановое начало, от него считается опоздание старта,
+    // tm - время прохода планировщика, снятое до запуска задачи.
+    inline bool ExecuteTask(TCallable& task, TStat& stat, TLog& log, tick_t plannedTime, tick_t tm) {
+        if (task(log)) {
+            stat.SetStartTime(tm);
+            stat.SetStopTime(TTimer::GetTime());
+            stat.Sample(plannedTime);
+            TraceExecution(plannedTime, tm, stat.GetStopTime(), true);
+            return true;
+        }
+        TraceDecline(plannedTime, tm);
+        return false;
+    }
+
+
+    // ///////////////////////// //
+    //        TSlotTuner         //
+    // ///////////////////////// //
+    // Подбор minDuration и padding тайм-слота по наблюдаемым длительностям
+    // задачи. Оценка как у тайм-аута TCP: сглаженное среднее (вес 1/8) и
+    // сглаженное среднее отклонение (вес 1/4), окно - среднее плюс четыре
+    // отклонения, что покрывает почти все выполнения. padding - одно
+    // отклонение, запас на случай, если задача все же вылезла за окно.
+    // Оба значения держатся в границах, заданных пользователем.
+#ifndef MTLOOP_SLOT_TUNING
+#ifdef ARDUINO_ARCH_AVR
+#define MTLOOP_SLOT_TUNING 0
+#else
+#define MTLOOP_SLOT_TUNING 1
+#endif
+#endif
+#if MTLOOP_SLOT_TUNING
+    class TSlotTuner {
+        public:
+            TSlotTuner();
+            void Enable(tick_t durationLow, tick_t durationHigh, tick_t paddingLow, tick_t paddingHigh);
+            void Disable();
+            bool IsEnabled() const;
+            // Учесть выполнение длительностью duration и пересчитать окно
+            void Update(tick_t duration, tick_t& minDuration, tick_t& padding);
+            tick_t GetMean() const;
+            tick_t GetDeviation() const;
+        private:
+#if MTLOOP_TICK_BITS == 64
+            using tune_t = int64_t;
+#else
+            using tune_t = int32_t;
+#endif
+            static tick_t Clamp(tune_t value, tick_t low, tick_t high);
+
+            tune_t mean;            // Среднее * 8
+            tune_t deviation;       // Среднее отклонение * 4
+            tick_t durationLow;
+            tick_t durationHigh;
+            tick_t paddingLow;
+            tick_t paddingHigh;
+            bool enabled;
+            bool sampled;
+    };
+
+    inline TSlotTuner::TSlotTuner()
+        : mean(0)
+        , deviation(0)
+        , durationLow(0)
+        , durationHigh(0)
+        , paddingLow(0)
+        , paddingHigh(0)
+        , enabled(false)
+        , sampled(false) {
+    }
+    inline void TSlotTuner::Enable(tick_t durationLow, tick_t durationHigh, tick_t paddingLow, tick_t paddingHigh) {
+        this->durationLow = durationLow;
+        this->durationHigh = durationHigh < durationLow ? durationLow : durationHigh;
+        this->paddingLow = paddingLow;
+        this->paddingHigh = paddingHigh < paddingLow ? paddingLow : paddingHigh;
+        enabled = true;
+    }
+    inline void TSlotTuner::Disable() {
+        enabled = false;
+    }
+    inline bool TSlotTuner::IsEnabled() const {
+        return enabled;
+    }
+    inline tick_t TSlotTuner::Clamp(tune_t value, tick_t low, tick_t high) {
+        if (value < static_cast<tune_t>(low))
+            return low;
+        if (value > static_cast<tune_t>(high))
+            return high;
+        return static_cast<tick_t>(value);
+    }
+    inline void TSlotTuner::Update(tick_t duration, tick_t& minDuration, tick_t& padding) {
+        tune_t sample = static_cast<tune_t>(duration);
+        if (!sampled) {
+            mean = sample * 8;
+            deviation = sample * 2;
+            sampled = true;
+        } else {
+            tune_t error = sample - mean / 8;
+            mean += error;
+            // Округление вверх, иначе малое отклонение никогда не уходит в ноль
+            deviation += (error < 0 ? -error : error) - (deviation + 3) / 4;
+        }
+        minDuration = Clamp(mean / 8 + deviation, durationLow, durationHigh);
+        padding = Clamp(deviation / 4, paddingLow, paddingHigh);
+    }
+    inline tick_t TSlotTuner::GetMean() const {
+        return static_cast<tick_t>(mean / 8);
+    }
+    inline tick_t TSlotTuner::GetDeviation() const {
+        return static_cast<tick_t>(deviation / 4);
+    }
+#endif
+
+
+    // ///////////////////////// //
+    //         TTimeSlot         //
+    // ///////////////////////// //
+    class TTimeSlot final: public IRunnable {
+    public:
+        TTimeSlot(TCallable task, tick_t minDuration = DEFAULT_SLOT_MIN_DURATION, tick_t padding = DEFAULT_SLOT_PADDING, tick_t budget = 0);
+        TTimeSlot(const TTimeSlot& ts);
+        virtual ~TTimeSlot();
+        TTimeSlot * Clone() const;
+        TTimeSlot * CloneTo(void* place) const;
+        TTimeSlot& operator=(const TTimeSlot& ts);
+        bool Run(TLog& log) override;
+        bool Execute(TLog& log);
+        // Варианты для планировщика: tm - время, прочитанное один раз на проход
+        bool Run(TLog& log, tick_t tm);
+        bool Execute(TLog& log, tick_t tm);
+        void SetStartTime(tick_t time);
+        void SetMinDuration(tick_t time);
+        void SetPadding(tick_t time);
+        void SetBudget(tick_t time);
+        tick_t GetMinDuration() const;
+        tick_t GetPadding() const;
+        tick_t GetBudget() const;
+        const TCallable& GetTask() const;
+        tick_t GetLTime() const;
+        tick_t GetRTime();
+        tick_t GetRTime(tick_t tm);
+        TStat& GetStat();
+        bool CheckOverrun();    // Последнее выполнение дольше бюджета
+#if MTLOOP_SLOT_TUNING
+        // Подстраивать minDuration и padding под длительность задачи в границах
+        void SetAutoTune(tick_t durationLow, tick_t durationHigh, tick_t paddingLow = 0, tick_t paddingHigh = 0);
+        void StopAutoTune();    // Оставляет подобранные значения
+        TSlotTuner& GetTuner();
+#endif
+    private:
+        TCallable task;
+        TStat stat;
+#if MTLOOP_SLOT_TUNING
+        TSlotTuner tuner;
+#endif
+        tick_t slotStartTime = 1;
+        tick_t minDuration;
+        tick_t padding;
+        tick_t budget;          // 0 - бюджет равен minDuration
+        bool executed = false;  // Задача выполнилась после последнего SetStartTime
+    };
+
+    inline TTimeSlot::TTimeSlot(TCallable task, tick_t minDuration, tick_t padding, tick_t budget)
+        : task(task)
+        , minDuration(minDuration)
+        , padding(padding)
+        , budget(budget) {
+    }
+    inline TTimeSlot::TTimeSlot(const TTimeSlot& ts)
+        : task(ts.task)
+        , stat(ts.stat)
+#if MTLOOP_SLOT_TUNING
+        , tuner(ts.tuner)
+#endif
+        , slotStartTime(ts.slotStartTime)
+        , minDuration(ts.minDuration)
+        , padding(ts.padding)
+        , budget(ts.budget)
+        , executed(ts.executed) {
+    }
+    inline TTimeSlot& TTimeSlot::operator=(const TTimeSlot& ts) {
+        if(this != &ts) {
+            task = ts.task;
+            stat = ts.stat;
+#if MTLOOP_SLOT_TUNING
+            tuner = ts.tuner;
+#endif
+            slotStartTime = ts.slotStartTime;
+            minDuration = ts.minDuration;
+            padding = ts.padding;
+            budget = ts.budget;
+            executed = ts.executed;
+        }
+        return *this;
+    }
+    inline TTimeSlot::~TTimeSlot() {
+    }
+    inline TTimeSlot * TTimeSlot::Clone() const {
+        return new TTimeSlot(*this);
+    }
+    inline TTimeSlot * TTimeSlot::CloneTo(void* place) const {
+        return new (place) TTimeSlot(*this);
+    }
+    inline void TTimeSlot::SetStartTime(tick_t time) {
+        slotStartTime = time;
+        executed = false;
+    }
+    inline void TTimeSlot::SetMinDuration(tick_t time) {
+        minDuration = time;
+    }
+    inline void TTimeSlot::SetPadding(tick_t time) {
+        padding = time;
+    }
+    inline void TTimeSlot::SetBudget(tick_t time) {
+        budget = time;
+    }
+    inline tick_t TTimeSlot::GetMinDuration() const {
+        return minDuration;
+    }
+    inline tick_t TTimeSlot::GetPadding() const {
+        return padding;
+    }
+    inline tick_t TTimeSlot::GetBudget() const {
+        return budget > 0 ? budget : minDuration;
+    }
+    inline const TCallable& TTimeSlot::GetTask() const {
+        return task;
+    }
+    inline bool TTimeSlot::CheckOverrun() {
+        if (stat.GetDuration() <= GetBudget())
+            return false;
+        stat.AddOverrun();
+        return true;
+    }
+    inline bool TTimeSlot::Run(TLog& log) {
+        return Run(log, TTimer::GetTime());
+    }
+    inline bool TTimeSlot::Run(TLog& log, tick_t tm) {
+        if (TimeBefore(tm, slotStartTime))
+            return false;
+        if (executed)
+            return true;
+        if (Execute(log, tm))
+            return true;
+        return false;
+    }
+    inline bool TTimeSlot::Execute(TLog& log) {
+        return Execute(log, TTimer::GetTime());
+    }
+    inline bool TTimeSlot::Execute(TLog& log, tick_t tm) {
+        if (!ExecuteTask(task, stat, log, slotStartTime, tm))
+            return false;
+        executed = true;
+#if MTLOOP_SLOT_TUNING
+        if (tuner.IsEnabled())
+            tuner.Update(stat.GetDuration(), minDuration, padding);
+#endif
+        return true;
+    }
+    inline tick_t TTimeSlot::GetLTime() const {
+        return slotStartTime;
+    }
+    inline tick_t TTimeSlot::GetRTime() {
+        return GetRTime(TTimer::GetTime());
+    }
+    inline tick_t TTimeSlot::GetRTime(tick_t tm) {
+        return SlotRTime(tm, slotStartTime, minDuration, padding, executed, stat.GetStopTime());
+    }
+    inline TStat& TTimeSlot::GetStat() {
+        return stat;
+    }
+#if MTLOOP_SLOT_TUNING
+    inline void TTimeSlot::SetAutoTune(tick_t durationLow, tick_t durationHigh, tick_t paddingLow, tick_t paddingHigh) {
+        tuner.Enable(durationLow, durationHigh, paddingLow, paddingHigh);
+    }
+    inline void TTimeSlot::StopAutoTune() {
+        tuner.Disable();
+    }
+    inline TSlotTuner& TTimeSlot::GetTuner() {
+        return tuner;
+    }
+#endif
+
+
+    // ///////////////////////// //
+    //         IChain            //
+    // ///////////////////////// //
+    // Вызывается, когда задача тайм-слота вышла за бюджет
+    using overrunHookPtr = void(*)(TTimeSlot& slot, TLog& log);
+
+    // Цепочка тайм-слотов, которой управляет TLoop
+    class IChain {
+        public:
+            virtual bool Run(TLog& log) = 0;
+            // Проход планировщика со временем tm, прочитанным до запуска цепочки.
+            // По умолчанию цепочка читает время сама.
+            virtual bool Run(TLog& log, tick_t tm);
+            virtual tick_t GetLTime() = 0;  // Начало текущего тайм-слота
+            // Изменение состава цепочки, если цепочка его поддерживает
+            virtual bool Insert(size_t pos, const TTimeSlot& ts);
+            virtual bool Remove(size_t pos);
+            virtual bool SetOverrunPolicy(TOverrunPolicy policy, overrunHookPtr hook = nullptr);
+            virtual ~IChain() = default;
+            // Цепочке больше нечего выполнять: TLoop отсоединяет ее после Run
+            bool IsFinished() const;
+        protected:
+            void Finish();
+        private:
+            bool finished = false;
+    };
+
+    inline bool IChain::Run(TLog& log, tick_t tm) {
+        return Run(log);
+    }
+    inline bool IChain::Insert(size_t pos, const TTimeSlot& ts) {
+        return false;
+    }
+    inline bool IChain::Remove(size_t pos) {
+        return false;
+    }
+    inline bool IChain::SetOverrunPolicy(TOverrunPolicy policy, overrunHookPtr hook) {
+        return false;
+    }
+    inline bool IChain::IsFinished() const {
+        return finished;
+    }
+    inline void IChain::Finish() {
+        finished = true;
+    }
+
+
+    // ///////////////////////// //
+    //      TTimeSlotChain       //
+    // ///////////////////////// //
+    using TTimeSlotPtr = TTimeSlot *;
+    class TTimeSlotChain: public IChain {
+        public:
+            TTimeSlotChain(const std::initializer_list<TTimeSlot>& ts);
             ~TTimeSlotChain();
-            bool Run(TLog& log);
+            bool Run(TLog& log) override;
+            bool Run(TLog& log, tick_t tm) override;
+            tick_t GetLTime() override;
+            bool Insert(size_t pos, const TTimeSlot& ts) override;
+            bool Remove(size_t pos) override;
+            bool SetOverrunPolicy(TOverrunPolicy policy, overrunHookPtr hook = nullptr) override;
+            size_t Size() const;
+            TTimeSlot& At(size_t pos);
+#if MTLOOP_SLOT_TUNING
+            void SetAutoTune(tick_t durationLow, tick_t durationHigh, tick_t paddingLow = 0, tick_t paddingHigh = 0);
+#endif
+        protected:
+            // Тайм-слоты размещаются в памяти storage, не более capacity штук
+            TTimeSlotChain(const std::initializer_list<TTimeSlot>& ts, void* storage, size_t capacity);
+        private:
+            void Init(const std::initializer_list<TTimeSlot>& ts);
+            bool Grow();
+
+            TTimeSlotPtr timeSlots;
+            bool ownsStorage;
+            size_t capacity;
+            size_t size = 0;
+            size_t curTimeSlot = 0;
+            TOverrunPolicy overrunPolicy = OVERRUN_STRETCH;
+            overrunHookPtr overrunHook = nullptr;
+            tick_t nominalTime = 1;     // Плановое начало текущего тайм-слота
+    };
+
+    inline TTimeSlotChain::TTimeSlotChain(const std::initializer_list<TTimeSlot>& ts)
+        : timeSlots(static_cast<TTimeSlotPtr>(::operator new(ts.size() * sizeof(TTimeSlot))))
+        , ownsStorage(true)
+        , capacity(ts.size()) {
+        Init(ts);
+    }
+    inline TTimeSlotChain::TTimeSlotChain(const std::initializer_list<TTimeSlot>& ts, void* storage, size_t capacity)
+        : timeSlots(static_cast<TTimeSlotPtr>(storage))
+        , ownsStorage(false)
+        , capacity(capacity) {
+        Init(ts);
+    }
+    inline void TTimeSlotChain::Init(const std::initializer_list<TTimeSlot>& ts) {
+        for (const auto& item : ts) {
+            if (size >= capacity)
+                break;
+            item.CloneTo(&timeSlots[size++]);
+        }
+        if (size > 0)
+            nominalTime = timeSlots[0].GetLTime();
+    }
+    inline TTimeSlotChain::~TTimeSlotChain() {
+        for (size_t i = 0; i < size; ++i) {
+            timeSlots[i].~TTimeSlot();
+        }
+        if (ownsStorage)
+            ::operator delete(timeSlots);
+    }
+    inline bool TTimeSlotChain::Run(TLog& log) {
+        return Run(log, TTimer::GetTime());
+    }
+    inline bool TTimeSlotChain::Run(TLog& log, tick_t tm) {
+        TTimeSlot* ts = &timeSlots[curTimeSlot];
+        TraceSlot(curTimeSlot);
+        if (!ts->Run(log, tm))
+            return false;
+        if (ts->CheckOverrun()) {
+            if (overrunHook != nullptr)
+                overrunHook(*ts, log);
+            if (overrunPolicy == OVERRUN_LOG)
+                log.Write<LOG_WARNING>("MTLoop: time slot overrun");
+        }
+        tick_t startTime;
+        if (overrunPolicy == OVERRUN_STRETCH || overrunPolicy == OVERRUN_LOG) {
+            // Граница считается по времени окончания задачи, без нового чтения таймера
+            startTime = ts->GetRTime(ts->GetStat().GetStopTime()) + 1;
+            curTimeSlot = (curTimeSlot + 1) % size;
+            nominalTime = startTime;
+        } else {
+            // Границы тайм-слотов считаются от плановой сетки, а не от конца задачи
+            tick_t stopTime = ts->GetStat().GetStopTime();
+            nominalTime += ts->GetMinDuration();
+            curTimeSlot = (curTimeSlot + 1) % size;
+            if (overrunPolicy == OVERRUN_SKIP_NEXT) {
+                for (size_t skipped = 0; skipped + 1 < size; ++skipped) {
+                    TTimeSlot& next = timeSlots[curTimeSlot];
+                    if (TimeAfter(nominalTime + next.GetMinDuration(), stopTime))
+                        break;
+                    next.GetStat().AddSkip();
+                    nominalTime += next.GetMinDuration();
+                    curTimeSlot = (curTimeSlot + 1) % size;
+                }
+            }
+            startTime = TimeAfter(nominalTime, stopTime) ? nominalTime : stopTime + 1;
+        }
+        timeSlots[curTimeSlot].SetStartTime(startTime);
+        return true;
+    }
+    inline bool TTimeSlotChain::SetOverrunPolicy(TOverrunPolicy policy, overrunHookPtr hook) {
+        overrunPolicy = policy;
+        overrunHook = hook;
+        nominalTime = GetLTime();
+        return true;
+    }
+    inline tick_t TTimeSlotChain::GetLTime() {
+        return timeSlots[curTimeSlot].GetLTime();
+    }
+#if MTLOOP_SLOT_TUNING
+    inline void TTimeSlotChain::SetAutoTune(tick_t durationLow, tick_t durationHigh, tick_t paddingLow, tick_t paddingHigh) {
+        for (size_t i = 0; i < size; ++i)
+            timeSlots[i].SetAutoTune(durationLow, durationHigh, paddingLow, paddingHigh);
+    }
+#endif
+    inline bool TTimeSlotChain::Grow() {
+        // Внешняя память не растет
+        if (!ownsStorage)
+            return false;
+        size_t newCapacity = capacity > 0 ? capacity * 2 : 1;
+        TTimeSlotPtr newSlots = static_cast<TTimeSlotPtr>(::operator new(newCapacity * sizeof(TTimeSlot)));
+        for (size_t i = 0; i < size; ++i) {
+            new (&newSlots[i]) TTimeSlot(timeSlots[i]);
+            timeSlots[i].~TTimeSlot();
+        }
+        ::operator delete(timeSlots);
+        timeSlots = newSlots;
+        capacity = newCapacity;
+        return true;
+    }
+    inline bool TTimeSlotChain::Insert(size_t pos, const TTimeSlot& ts) {
+        if (pos > size || (size >= capacity && !Grow()))
+            return false;
+        if (pos == size) {
+            new (&timeSlots[size]) TTimeSlot(ts);
+        } else {
+            new (&timeSlots[size]) TTimeSlot(timeSlots[size - 1]);
+            for (size_t i = size - 1; i > pos; --i)
+                timeSlots[i] = timeSlots[i - 1];
+            timeSlots[pos] = ts;
+        }
+        size++;
+        if (size == 1)
+            nominalTime = timeSlots[0].GetLTime();
+        // Текущим остается тот же тайм-слот
+        if (size > 1 && pos <= curTimeSlot)
+            curTimeSlot++;
+        return true;
+    }
+    inline bool TTimeSlotChain::Remove(size_t pos) {
+        // Пустая цепочка не может выполняться
+        if (pos >= size || size == 1)
+            return false;
+        tick_t lTime = timeSlots[curTimeSlot].GetLTime();
+        for (size_t i = pos; i + 1 < size; ++i)
+            timeSlots[i] = timeSlots[i + 1];
+        timeSlots[--size].~TTimeSlot();
+        if (pos < curTimeSlot) {
+            curTimeSlot--;
+        } else if (pos == curTimeSlot) {
+            // Следующий тайм-слот начинается вместо удаленного
+            curTimeSlot %= size;
+            timeSlots[curTimeSlot].SetStartTime(lTime);
+        }
+        return true;
+    }
+    inline size_t TTimeSlotChain::Size() const {
+        return size;
+    }
+    inline TTimeSlot& TTimeSlotChain::At(size_t pos) {
+        return timeSlots[pos];
+    }
+
+
+    // ///////////////////////// //
+    //   TFixedTimeSlotChain     //
+    // ///////////////////////// //
+    // Цепочка не более чем из MaxSlots тайм-слотов, размещенных внутри объекта
+    template<size_t MaxSlots>
+    class TFixedTimeSlotChain: public TTimeSlotChain {
+        public:
+            TFixedTimeSlotChain(const std::initializer_list<TTimeSlot>& ts);
+        private:
+            struct alignas(TTimeSlot) TSlotStorage {
+                unsigned char data[sizeof(TTimeSlot)];
+            };
+            TSlotStorage storage[MaxSlots];
+    };
+
+    template<size_t MaxSlots>
+    inline TFixedTimeSlotChain<MaxSlots>::TFixedTimeSlotChain(const std::initializer_list<TTimeSlot>& ts)
+        : TTimeSlotChain(ts, storage, MaxSlots) {
+    }
+
+
+    // ///////////////////////// //
+    //       TPackedChain        //
+    // ///////////////////////// //
+    // Цепочка с раскладкой "структура массивов": задачи, окна, отступы,
+    // бюджеты и последние старт и окончание лежат в параллельных массивах одного
+    // блока памяти, время начала текущего тайм-слота - в самом объекте. Проход,
+    // который только проверяет срок, не выходит за объект цепочки, а выполнение
+    // читает по элементу из нескольких коротких массивов вместо TTimeSlot
+    // целиком со статистикой и гистограммами.
+    // Состав цепочки задается при создании; вместо TStat - старт, окончание и
+    // счетчики превышений и пропусков, подстройки окна и хука превышения нет.
+    class TPackedChain final: public IChain {
+        public:
+            TPackedChain(const std::initializer_list<TTimeSlot>& ts);
+            TPackedChain(const TPackedChain&) = delete;
+            TPackedChain& operator=(const TPackedChain&) = delete;
+            ~TPackedChain();
+            bool Run(TLog& log) override;
+            bool Run(TLog& log, tick_t tm) override;
+            tick_t GetLTime() override;
+            bool SetOverrunPolicy(TOverrunPolicy policy, overrunHookPtr hook = nullptr) override;
+            void SetStartTime(tick_t time);     // Начало текущего тайм-слота
+            size_t Size() const;
+            tick_t GetMinDuration(size_t pos) const;
+            tick_t GetPadding(size_t pos) const;
+            tick_t GetBudget(size_t pos) const;
+            tick_t GetStartTime(size_t pos) const;
+            tick_t GetStopTime(size_t pos) const;
+            tick_t GetDuration(size_t pos) const;
+            uint32_t GetOverrunCount(size_t pos) const;
+            uint32_t GetSkipCount(size_t pos) const;
+        private:
+            static size_t Align(size_t offset);
+
+            void* storage;
+            TCallable* tasks;
+            tick_t* minDurations;
+            tick_t* paddings;
+            tick_t* budgets;
+            tick_t* startTimes;
+            tick_t* stopTimes;
+            uint32_t* overruns;
+            uint32_t* skips;
+            size_t size;
+            size_t curTimeSlot = 0;
+            tick_t slotStartTime = 1;
+            TOverrunPolicy overrunPolicy = OVERRUN_STRETCH;
+            tick_t nominalTime = 1;     // Плановое начало текущего тайм-слота
+    };
+
+    inline size_t TPackedChain::Align(size_t offset) {
+        const size_t align = alignof(TCallable) > alignof(tick_t) ? alignof(TCallable) : alignof(tick_t);
+        return (offset + align - 1) / align * align;
+    }
+    inline TPackedChain::TPackedChain(const std::initializer_list<TTimeSlot>& ts)
+        : size(ts.size()) {
+        // Задачи первыми - у них самое строгое выравнивание, счетчики последними
+        size_t timesOffset = Align(size * sizeof(TCallable));
+        size_t countersOffset = Align(timesOffset + 5 * size * sizeof(tick_t));
+        unsigned char* block = static_cast<unsigned char*>(::operator new(countersOffset + 2 * size * sizeof(uint32_t)));
+        storage = block;
+        tasks = reinterpret_cast<TCallable*>(block);
+        minDurations = reinterpret_cast<tick_t*>(block + timesOffset);
+        paddings = minDurations + size;
+        budgets = paddings + size;
+        startTimes = budgets + size;
+        stopTimes = startTimes + size;
+        overruns = reinterpret_cast<uint32_t*>(block + countersOffset);
+        skips = overruns + size;
+        size_t i = 0;
+        for (const auto& item : ts) {
+            new (&tasks[i]) TCallable(item.GetTask());
+            minDurations[i] = item.GetMinDuration();
+            paddings[i] = item.GetPadding();
+            budgets[i] = item.GetBudget();
+            startTimes[i] = 0;
+            stopTimes[i] = 0;
+            overruns[i] = 0;
+            skips[i] = 0;
+            ++i;
+        }
+        if (size > 0)
+            slotStartTime = ts.begin()->GetLTime();
+        nominalTime = slotStartTime;
+    }
+    inline TPackedChain::~TPackedChain() {
+        for (size_t i = 0; i < size; ++i)
+            tasks[i].~TCallable();
+        ::operator delete(storage);
+    }
+    inline bool TPackedChain::Run(TLog& log) {
+        return Run(log, TTimer::GetTime());
+    }
+    inline bool TPackedChain::Run(TLog& log, tick_t tm) {
+        if (size == 0 || TimeBefore(tm, slotStartTime))
+            return false;
+        size_t cur = curTimeSlot;
+        TraceSlot(cur);
+        if (!tasks[cur](log)) {
+            TraceDecline(slotStartTime, tm);
+            return false;
+        }
+        tick_t stopTime = TTimer::GetTime();
+        startTimes[cur] = tm;
+        stopTimes[cur] = stopTime;
+        TraceExecution(slotStartTime, tm, stopTime, true);
+        if (static_cast<tick_t>(stopTime - tm) > budgets[cur]) {
+            overruns[cur]++;
+            if (overrunPolicy == OVERRUN_LOG)
+                log.Write<LOG_WARNING>("MTLoop: time slot overrun");
+        }
+        curTimeSlot = (cur + 1) % size;
+        if (overrunPolicy == OVERRUN_STRETCH || overrunPolicy == OVERRUN_LOG) {
+            slotStartTime = SlotRTime(stopTime, slotStartTime, minDurations[cur], paddings[cur], true, stopTime) + 1;
+            nominalTime = slotStartTime;
+            return true;
+        }
+        // Как в TTimeSlotChain: границы от плановой сетки
+        nominalTime += minDurations[cur];
+        if (overrunPolicy == OVERRUN_SKIP_NEXT) {
+            for (size_t skipped = 0; skipped + 1 < size; ++skipped) {
+                if (TimeAfter(nominalTime + minDurations[curTimeSlot], stopTime))
+                    break;
+                skips[curTimeSlot]++;
+                nominalTime += minDurations[curTimeSlot];
+                curTimeSlot = (curTimeSlot + 1) % size;
+            }
+        }
+        slotStartTime = TimeAfter(nominalTime, stopTime) ? nominalTime : stopTime + 1;
+        return true;
+    }
+    inline tick_t TPackedChain::GetLTime() {
+        return slotStartTime;
+    }
+    inline bool TPackedChain::SetOverrunPolicy(TOverrunPolicy policy, overrunHookPtr hook) {
+        // Хук получает TTimeSlot, которого у этой цепочки нет
+        if (hook != nullptr)
+            return false;
+        overrunPolicy = policy;
+        nominalTime = slotStartTime;
+        return true;
+    }
+    inline void TPackedChain::SetStartTime(tick_t time) {
+        slotStartTime = time;
+        nominalTime = time;
+    }
+    inline size_t TPackedChain::Size() const {
+        return size;
+    }
+    inline tick_t TPackedChain::GetMinDuration(size_t pos) const {
+        return minDurations[pos];
+    }
+    inline tick_t TPackedChain::GetPadding(size_t pos) const {
+        return paddings[pos];
+    }
+    inline tick_t TPackedChain::GetBudget(size_t pos) const {
+        return budgets[pos];
+    }
+    inline tick_t TPackedChain::GetStartTime(size_t pos) const {
+        return startTimes[pos];
+    }
+    inline tick_t TPackedChain::GetStopTime(size_t pos) const {
+        return stopTimes[pos];
+    }
+    inline tick_t TPackedChain::GetDuration(size_t pos) const {
+        return stopTimes[pos] - startTimes[pos];
+    }
+    inline uint32_t TPackedChain::GetOverrunCount(size_t pos) const {
+        return overruns[pos];
+    }
+    inline uint32_t TPackedChain::GetSkipCount(size_t pos) const {
+        return skips[pos];
+    }
+
+
+    // ///////////////////////// //
+    //         TChainHeap        //
+    // ///////////////////////// //
+    // Индексированная min-куча цепочек, ключ - время начала текущего
+    // тайм-слота цепочки. При равных ключах первой идет цепочка, ключ
+    // которой обновлялся раньше. В порядке ORDER_PRIORITY ключ предваряет
+    // класс приоритета цепочки.
+    struct TChainHeapEntry {
+        size_t id;          // Цепочка в позиции кучи
+        size_t pos;         // Позиция цепочки в куче
+        tick_t deadline;    // Ключ цепочки
+        uint32_t seq;       // Порядковый номер обновления ключа
+        uint8_t priority = DEFAULT_CHAIN_PRIORITY;  // Класс приоритета, больше - старше
+    };
+    enum TChainOrder {
+        ORDER_DEADLINE,     // По сроку
+        ORDER_PRIORITY      // По классу приоритета, затем по сроку
+    };
+
+    // Порядок - параметр шаблона: сравнение в горячем пути без лишних ветвлений.
+    // Куча ORDER_PRIORITY может жить в памяти кучи ORDER_DEADLINE: ее позиции
+    // занимаются с конца storage, а цепочка лежит только в одной из двух куч.
+    template<TChainOrder Order>
+    class TOrderedChainHeap {
+        public:
+            using TEntry = TChainHeapEntry;
+
+            TOrderedChainHeap(size_t capacity);
+            TOrderedChainHeap(TEntry* storage, size_t capacity = 0);
+            ~TOrderedChainHeap();
+            void Push(size_t id, tick_t deadline);
+            void Push(size_t id, tick_t deadline, uint8_t priority);
+            void Update(size_t id, tick_t deadline);
+            void Remove(size_t id);
+            void SetPriority(size_t id, uint8_t priority);
+            uint8_t GetPriority(size_t id) const;
+            // Переход во внешнюю память большей емкости. Записи цепочек переносит
+            // владелец памяти до вызова, куча переносит только свои позиции
+            void Relocate(TEntry* storage, size_t capacity);
+            size_t Top() const;
+            tick_t TopDeadline() const;
+            size_t Size() const;
+        private:
+            TEntry& Slot(size_t pos) const;
+            bool Less(size_t a, size_t b) const;
+            void Swap(size_t a, size_t b);
+            void SiftUp(size_t pos);
+            void SiftDown(size_t pos);
+
+            TEntry* entries;        // По номеру цепочки: pos, deadline, seq, priority;
+                                    // по позиции в куче ORDER_DEADLINE: id
+            TEntry* slots;          // Последняя запись памяти - позиция 0 кучи ORDER_PRIORITY
+            bool ownsStorage;
+            size_t size;
+            uint32_t nextSeq;
+    };
+
+    using TChainHeap = TOrderedChainHeap<ORDER_DEADLINE>;
+    using TReadyChainHeap = TOrderedChainHeap<ORDER_PRIORITY>;
+
+    template<TChainOrder Order>
+    inline TOrderedChainHeap<Order>::TOrderedChainHeap(size_t capacity)
+        : entries(new TEntry[capacity])
+        , slots(Order == ORDER_PRIORITY ? entries + capacity - 1 : entries)
+        , ownsStorage(true)
+        , size(0)
+        , nextSeq(0) {
+    }
+    template<TChainOrder Order>
+    inline TOrderedChainHeap<Order>::TOrderedChainHeap(TEntry* storage, size_t capacity)
+        : entries(storage)
+        , slots(Order == ORDER_PRIORITY ? storage + capacity - 1 : storage)
+        , ownsStorage(false)
+        , size(0)
+        , nextSeq(0) {
+    }
+    template<TChainOrder Order>
+    inline TOrderedChainHeap<Order>::~TOrderedChainHeap() {
+        if (ownsStorage)
+            delete[] entries;
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::Push(size_t id, tick_t deadline) {
+        Slot(size).id = id;
+        entries[id].pos = size;
+        entries[id].deadline = deadline;
+        entries[id].seq = nextSeq++;
+        SiftUp(size++);
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::Push(size_t id, tick_t deadline, uint8_t priority) {
+        entries[id].priority = priority;
+        Push(id, deadline);
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::Update(size_t id, tick_t deadline) {
+        entries[id].deadline = deadline;
+        entries[id].seq = nextSeq++;
+        SiftUp(entries[id].pos);
+        SiftDown(entries[id].pos);
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::Remove(size_t id) {
+        size_t pos = entries[id].pos;
+        Swap(pos, --size);
+        if (pos < size) {
+            size_t moved = Slot(pos).id;
+            SiftUp(pos);
+            SiftDown(entries[moved].pos);
+        }
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::SetPriority(size_t id, uint8_t priority) {
+        entries[id].priority = priority;
+        if (Order == ORDER_PRIORITY) {
+            SiftUp(entries[id].pos);
+            SiftDown(entries[id].pos);
+        }
+    }
+    template<TChainOrder Order>
+    inline uint8_t TOrderedChainHeap<Order>::GetPriority(size_t id) const {
+        return entries[id].priority;
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::Relocate(TEntry* storage, size_t capacity) {
+        TEntry* newSlots = Order == ORDER_PRIORITY ? storage + capacity - 1 : storage;
+        for (size_t pos = 0; pos < size; ++pos) {
+            TEntry& slot = Order == ORDER_PRIORITY ? *(newSlots - pos) : storage[pos];
+            slot.id = Slot(pos).id;
+        }
+        entries = storage;
+        slots = newSlots;
+    }
+    template<TChainOrder Order>
+    inline size_t TOrderedChainHeap<Order>::Top() const {
+        return Slot(0).id;
+    }
+    template<TChainOrder Order>
+    inline tick_t TOrderedChainHeap<Order>::TopDeadline() const {
+        return entries[Slot(0).id].deadline;
+    }
+    template<TChainOrder Order>
+    inline size_t TOrderedChainHeap<Order>::Size() const {
+        return size;
+    }
+    template<TChainOrder Order>
+    inline TChainHeapEntry& TOrderedChainHeap<Order>::Slot(size_t pos) const {
+        return Order == ORDER_PRIORITY ? *(slots - pos) : entries[pos];
+    }
+    template<TChainOrder Order>
+    inline bool TOrderedChainHeap<Order>::Less(size_t a, size_t b) const {
+        const TEntry& ea = entries[Slot(a).id];
+        const TEntry& eb = entries[Slot(b).id];
+        if (Order == ORDER_PRIORITY && ea.priority != eb.priority)
+            return ea.priority > eb.priority;
+        if (ea.deadline != eb.deadline)
+            return TimeBefore(ea.deadline, eb.deadline);
+        return static_cast<int32_t>(ea.seq - eb.seq) < 0;
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::Swap(size_t a, size_t b) {
+        TEntry& sa = Slot(a);
+        TEntry& sb = Slot(b);
+        size_t id = sa.id;
+        sa.id = sb.id;
+        sb.id = id;
+        entries[sa.id].pos = a;
+        entries[sb.id].pos = b;
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::SiftUp(size_t pos) {
+        while (pos > 0) {
+            size_t parent = (pos - 1) / 2;
+            if (!Less(pos, parent))
+                break;
+            Swap(pos, parent);
+            pos = parent;
+        }
+    }
+    template<TChainOrder Order>
+    inline void TOrderedChainHeap<Order>::SiftDown(size_t pos) {
+        for (;;) {
+            size_t least = pos;
+            size_t left = 2 * pos + 1;
+            size_t right = left + 1;
+            if (left < size && Less(left, least))
+                least = left;
+            if (right < size && Less(right, least))
+                least = right;
+            if (least == pos)
+                break;
+            Swap(pos, least);
+            pos = least;
+        }
+    }
+
+
+    // ///////////////////////// //
+    //        TTimerWheel        //
+    // ///////////////////////// //
+    // Иерархическое колесо таймеров для разовых задач. Уровень l колеса хранит
+    // таймеры, у которых старшая цифра (по WHEEL_BITS бит), отличающаяся от
+    // текущего времени колеса, имеет номер l. Добавление и отмена - O(1),
+    // Advance перескакивает пустые слоты по битовым картам занятости.
+#ifndef MTLOOP_WHEEL_BITS
+#define MTLOOP_WHEEL_BITS 6
+#endif
+    using TTimerHandle = uint32_t;
+    const TTimerHandle INVALID_TIMER = 0;
+    const size_t DEFAULT_TIMER_COUNT = 8;
+
+    class TTimerWheel {
+        public:
+            static const unsigned WHEEL_BITS = MTLOOP_WHEEL_BITS;
+            static const unsigned WHEEL_SLOTS = 1u << WHEEL_BITS;
+            static const unsigned WHEEL_LEVELS = (sizeof(tick_t) * 8 + WHEEL_BITS - 1) / WHEEL_BITS;
+            static const size_t MAX_TIMER_COUNT = 0xFFFE;
+            static_assert(WHEEL_BITS <= 6, "Occupancy bitmap is 64 bit wide");
+
+            struct TNode {
+                TCallable task;
+                tick_t expire;
+                uint16_t next;
+                uint16_t prev;
+                uint16_t list;      // Список, в котором находится таймер
+                uint16_t gen;       // Поколение - защита от устаревших дескрипторов
+            };
+
+            TTimerWheel(size_t capacity, tick_t now);
+            TTimerWheel(TNode* storage, size_t capacity, tick_t now);
+            ~TTimerWheel();
+            TTimerHandle Post(tick_t time, const TCallable& task);
+            bool Cancel(TTimerHandle handle);
+            void Advance(tick_t tm);
+            bool RunReady(TLog& log, tick_t tm);
+            bool HasReady() const;
+            tick_t ReadyTime() const;
+            tick_t NextTime() const;
+            size_t Pending() const;
+            TStat& GetStat();
+        private:
+            static const uint16_t NIL = 0xFFFF;
+            static const uint16_t LIST_FREE = 0xFFFF;
+            static const uint16_t LIST_READY = 0xFFFE;
+            static const uint16_t LIST_RUNNING = 0xFFFD;
+
+            struct TList {
+                uint16_t head;
+                uint16_t tail;
+            };
+
+            void Init(tick_t now);
+            bool Grow();
+            void Insert(uint16_t idx);
+            void PushBack(TList& list, uint16_t listId, uint16_t idx);
+            void Unlink(uint16_t idx);
+            void Release(uint16_t idx);
+            void Cascade(unsigned level);
+            void Expire();
+            TList& ListOf(uint16_t listId);
+            bool NextSlotTime(unsigned level, bool includeCurrent, tick_t& time) const;
+            static unsigned Digit(tick_t tm, unsigned level);
+
+            TNode* nodes;
+            bool ownsStorage;
+            size_t capacity;
+            size_t pending;
+            uint16_t freeHead;
+            tick_t now;
+            TList slots[WHEEL_LEVELS][WHEEL_SLOTS];
+            uint64_t occupied[WHEEL_LEVELS];
+            TList ready;
+            TStat stat;
+    };
+
+    inline TTimerWheel::TTimerWheel(size_t capacity, tick_t now)
+        : nodes(new TNode[capacity])
+        , ownsStorage(true)
+        , capacity(capacity) {
+        Init(now);
+    }
+    inline TTimerWheel::TTimerWheel(TNode* storage, size_t capacity, tick_t now)
+        : nodes(storage)
+        , ownsStorage(false)
+        , capacity(capacity) {
+        Init(now);
+    }
+    inline TTimerWheel::~TTimerWheel() {
+        if (ownsStorage)
+            delete[] nodes;
+    }
+    inline void TTimerWheel::Init(tick_t tm) {
+        now = tm;
+        pending = 0;
+        freeHead = NIL;
+        for (size_t i = capacity; i > 0; --i) {
+            nodes[i - 1].list = LIST_FREE;
+            nodes[i - 1].gen = 1;
+            nodes[i - 1].next = freeHead;
+            freeHead = i - 1;
+        }
+        for (unsigned l = 0; l < WHEEL_LEVELS; ++l) {
+            occupied[l] = 0;
+            for (unsigned d = 0; d < WHEEL_SLOTS; ++d)
+                slots[l][d].head = slots[l][d].tail = NIL;
+        }
+        ready.head = ready.tail = NIL;
+    }
+    inline bool TTimerWheel::Grow() {
+        if (!ownsStorage || capacity >= MAX_TIMER_COUNT)
+            return false;
+        size_t newCapacity = capacity * 2 + 1;
+        if (newCapacity > MAX_TIMER_COUNT)
+            newCapacity = MAX_TIMER_COUNT;
+        TNode* newNodes = new TNode[newCapacity];
+        for (size_t i = 0; i < capacity; ++i)
+            newNodes[i] = nodes[i];
+        for (size_t i = newCapacity; i > capacity; --i) {
+            newNodes[i - 1].list = LIST_FREE;
+            newNodes[i - 1].gen = 1;
+            newNodes[i - 1].next = freeHead;
+            freeHead = i - 1;
+        }
+        delete[] nodes;
+        nodes = newNodes;
+        capacity = newCapacity;
+        return true;
+    }
+    inline TTimerHandle TTimerWheel::Post(tick_t time, const TCallable& task) {
+        if (freeHead == NIL && !Grow())
+            return INVALID_TIMER;
+        uint16_t idx = freeHead;
+        TNode& node = nodes[idx];
+        freeHead = node.next;
+        node.task = task;
+        node.expire = TimeBefore(time, now) ? now : time;
+        pending++;
+        Insert(idx);
+        return (static_cast<TTimerHandle>(node.gen) << 16) | idx;
+    }
+    inline bool TTimerWheel::Cancel(TTimerHandle handle) {
+        uint16_t idx = handle & 0xFFFF;
+        if (idx >= capacity)
+            return false;
+        TNode& node = nodes[idx];
+        if (node.gen != (handle >> 16) || node.list == LIST_FREE || node.list == LIST_RUNNING)
+            return false;
+        Unlink(idx);
+        Release(idx);
+        return true;
+    }
+    inline void TTimerWheel::Advance(tick_t tm) {
+        if (pending == 0 || TimeBefore(tm, now)) {
+            if (TimeAfter(tm, now))
+                now = tm;
+            return;
+        }
+        for (;;) {
+            // Таймеры старших уровней, чья цифра совпала с текущим временем, опускаются ниже
+            for (unsigned l = WHEEL_LEVELS - 1; l > 0; --l)
+                Cascade(l);
+            Expire();
+            if (now == tm)
+                break;
+            // Ближайший момент, когда что-то произойдет на каком-либо уровне
+            tick_t next = tm;
+            for (unsigned l = 0; l < WHEEL_LEVELS; ++l) {
+                tick_t candidate;
+                if (NextSlotTime(l, false, candidate) && TimeBefore(candidate, next))
+                    next = candidate;
+            }
+            now = next;
+        }
+    }
+    inline bool TTimerWheel::RunReady(TLog& log, tick_t tm) {
+        if (ready.head == NIL)
+            return false;
+        uint16_t idx = ready.head;
+        Unlink(idx);
+        nodes[idx].list = LIST_RUNNING;
+        // Задача может добавлять таймеры и тем самым перемещать узлы - работаем с копией
+        TCallable task = nodes[idx].task;
+        TraceChain(TRACE_TIMER_CHAIN);
+        TraceSlot(idx);
+        if (ExecuteTask(task, stat, log, nodes[idx].expire, tm)) {
+            Release(idx);
+            return true;
+        }
+        // Задача не выполнилась - повторим после остальных готовых таймеров
+        nodes[idx].task = task;
+        PushBack(ready, LIST_READY, idx);
+        return false;
+    }
+    inline bool TTimerWheel::HasReady() const {
+        return ready.head != NIL;
+    }
+    inline tick_t TTimerWheel::ReadyTime() const {
+        return nodes[ready.head].expire;
+    }
+    inline tick_t TTimerWheel::NextTime() const {
+        if (ready.head != NIL)
+            return nodes[ready.head].expire;
+        tick_t next = now;
+        bool found = false;
+        for (unsigned l = 0; l < WHEEL_LEVELS; ++l) {
+            // На нулевом уровне слот текущего времени тоже в счет
+            tick_t candidate;
+            if (!NextSlotTime(l, l == 0, candidate))
+                continue;
+            if (!found || TimeBefore(candidate, next)) {
+                next = candidate;
+                found = true;
+            }
+        }
+        return next;
+    }
+    inline bool TTimerWheel::NextSlotTime(unsigned level, bool includeCurrent, tick_t& time) const {
+        unsigned digit = Digit(now, level);
+        uint64_t mask = includeCurrent
+            ? ~((static_cast<uint64_t>(1) << digit) - 1)
+            : ~((static_cast<uint64_t>(2) << digit) - 1);
+        uint64_t above = occupied[level] & mask;
+        unsigned shift = WHEEL_BITS * (level + 1);
+        tick_t base = shift < sizeof(tick_t) * 8 ? (now >> shift) << shift : 0;
+        if (above == 0) {
+            // Занятые слоты ниже текущей цифры относятся к следующему обороту уровня,
+            // для старшего уровня - к следующему переполнению счетчика
+            if (occupied[level] == 0)
+                return false;
+            above = occupied[level];
+            base += shift < sizeof(tick_t) * 8 ? static_cast<tick_t>(static_cast<tick_t>(1) << shift) : 0;
+        }
+        unsigned d = __builtin_ctzll(above);
+        time = base | (static_cast<tick_t>(d) << (WHEEL_BITS * level));
+        return true;
+    }
+    inline size_t TTimerWheel::Pending() const {
+        return pending;
+    }
+    inline TStat& TTimerWheel::GetStat() {
+        return stat;
+    }
+    inline void TTimerWheel::Insert(uint16_t idx) {
+        tick_t expire = nodes[idx].expire;
+        tick_t diff = expire ^ now;
+        unsigned l = 0;
+        while (l + 1 < WHEEL_LEVELS && (diff >> (WHEEL_BITS * (l + 1))) != 0)
+            l++;
+        unsigned d = Digit(expire, l);
+        occupied[l] |= static_cast<uint64_t>(1) << d;
+        PushBack(slots[l][d], l * WHEEL_SLOTS + d, idx);
+    }
+    inline void TTimerWheel::PushBack(TList& list, uint16_t listId, uint16_t idx) {
+        TNode& node = nodes[idx];
+        node.list = listId;
+        node.next = NIL;
+        node.prev = list.tail;
+        if (list.tail == NIL)
+            list.head = idx;
+        else
+            nodes[list.tail].next = idx;
+        list.tail = idx;
+    }
+    inline void TTimerWheel::Unlink(uint16_t idx) {
+        TNode& node = nodes[idx];
+        TList& list = ListOf(node.list);
+        if (node.prev == NIL)
+            list.head = node.next;
+        else
+            nodes[node.prev].next = node.next;
+        if (node.next == NIL)
+            list.tail = node.prev;
+        else
+            nodes[node.next].prev = node.prev;
+        if (list.head == NIL && node.list != LIST_READY) {
+            unsigned l = node.list / WHEEL_SLOTS;
+            occupied[l] &= ~(static_cast<uint64_t>(1) << (node.list % WHEEL_SLOTS));
+        }
+    }
+    inline void TTimerWheel::Release(uint16_t idx) {
+        TNode& node = nodes[idx];
+        node.task = TCallable();
+        node.list = LIST_FREE;
+        if (++node.gen == 0)
+            node.gen = 1;
+        node.next = freeHead;
+        freeHead = idx;
+        pending--;
+    }
+    inline void TTimerWheel::Cascade(unsigned level) {
+        unsigned d = Digit(now, level);
+        TList& list = slots[level][d];
+        uint16_t idx = list.head;
+        if (idx == NIL)
+            return;
+        list.head = list.tail = NIL;
+        occupied[level] &= ~(static_cast<uint64_t>(1) << d);
+        while (idx != NIL) {
+            uint16_t next = nodes[idx].next;
+            Insert(idx);
+            idx = next;
+        }
+    }
+    inline void TTimerWheel::Expire() {
+        unsigned d = Digit(now, 0);
+        TList& list = slots[0][d];
+        if (list.head == NIL)
+            return;
+        for (uint16_t idx = list.head; idx != NIL; idx = nodes[idx].next)
+            nodes[idx].list = LIST_READY;
+        if (ready.tail == NIL) {
+            ready.head = list.head;
+        } else {
+            nodes[ready.tail].next = list.head;
+            nodes[list.head].prev = ready.tail;
+        }
+        ready.tail = list.tail;
+        list.head = list.tail = NIL;
+        occupied[0] &= ~(static_cast<uint64_t>(1) << d);
+    }
+    inline TTimerWheel::TList& TTimerWheel::ListOf(uint16_t listId) {
+        if (listId == LIST_READY)
+            return ready;
+        return slots[listId / WHEEL_SLOTS][listId % WHEEL_SLOTS];
+    }
+    inline unsigned TTimerWheel::Digit(tick_t tm, unsigned level) {
+        return (tm >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    }
+
+
+    // ///////////////////////// //
+    //         Atomic            //
+    // ///////////////////////// //
+    // Атомарные операции для очереди команд TLoop. На AVR - запрет прерываний,
+    // на остальных платформах - встроенные атомарные функции GCC.
+#ifdef ARDUINO_ARCH_AVR
+    template<typename T>
+    inline T AtomicLoad(T& var) {
+        T value;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            value = var;
+        }
+        return value;
+    }
+    template<typename T>
+    inline void AtomicStore(T& var, T value) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            var = value;
+        }
+    }
+    template<typename T>
+    inline T AtomicExchange(T& var, T value) {
+        T old;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            old = var;
+            var = value;
+        }
+        return old;
+    }
+    template<typename T>
+    inline bool AtomicCompareExchange(T& var, T& expected, T desired) {
+        bool equal;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            equal = var == expected;
+            if (equal)
+                var = desired;
+            else
+                expected = var;
+        }
+        return equal;
+    }
+#else
+    template<typename T>
+    inline T AtomicLoad(T& var) {
+        return __atomic_load_n(&var, __ATOMIC_ACQUIRE);
+    }
+    template<typename T>
+    inline void AtomicStore(T& var, T value) {
+        __atomic_store_n(&var, value, __ATOMIC_RELEASE);
+    }
+    template<typename T>
+    inline T AtomicExchange(T& var, T value) {
+        return __atomic_exchange_n(&var, value, __ATOMIC_ACQ_REL);
+    }
+    template<typename T>
+    inline bool AtomicCompareExchange(T& var, T& expected, T desired) {
+        return __atomic_compare_exchange_n(&var, &expected, desired, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+#endif
+
+
+    // ///////////////////////// //
+    //       TDeferredLog        //
+    // ///////////////////////// //
+    // Отложенный лог: Write() сохраняет в кольцо указатель на строку формата и
+    // аргументы как есть, а форматирование и вывод делает Flush() вне горячего
+    // пути - в свободное время loop() или в отдельном потоке (MTLogThread.h).
+    // Один писатель (поток планировщика) и один читатель, без блокировок.
+    // Кольцо не ждет читателя: при переполнении запись теряется и учитывается
+    // в GetDropped(). Формат и аргументы %s должны жить до Flush() - литералы,
+    // поэтому char* в Write() не компилируется.
+    // Log() строку не форматирует, а копирует в запись (она часто собрана в
+    // буфере на стеке), обрезая до размера аргументов записи.
+    // Формат: %d %u %x %c %s %%, ширина и заполнение нулями, 'l' допускается.
+#ifndef MTLOOP_DEFERRED_LOG_SIZE
+#define MTLOOP_DEFERRED_LOG_SIZE 64
+#endif
+#ifndef MTLOOP_LOG_ARGS
+#define MTLOOP_LOG_ARGS 4
+#endif
+#ifndef MTLOOP_LOG_LINE
+#define MTLOOP_LOG_LINE 96
+#endif
+    union TLogArg {
+        long value;
+        const char* str;
+    };
+
+    struct TLogRecord {
+        const char* format;
+        union {
+            TLogArg args[MTLOOP_LOG_ARGS];
+            char text[MTLOOP_LOG_ARGS * sizeof(TLogArg)];   // Копия строки Log()
+        };
+        uint8_t argc;
+    };
+    const uint8_t LOG_TEXT_RECORD = 0xFF;   // argc записи Log(): аргумент %s - text
+
+    class TDeferredLog: public TLog {
+        public:
+            static constexpr size_t SIZE = MTLOOP_DEFERRED_LOG_SIZE;
+            static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "MTLOOP_DEFERRED_LOG_SIZE must be a power of two");
+
+            TDeferredLog();
+            void Log(const char* logLine) override;
+            template<TLogLevel Level = LOG_INFO, typename... Args> void Write(const char* format, Args... args);
+            size_t Flush(TLog& sink);                       // Записей выведено
+            template<typename TSink> size_t FlushTo(TSink sink); // sink(const char* line)
+            size_t GetPending();
+            uint32_t GetDropped();
+            static size_t Format(const TLogRecord& record, char* line, size_t size);
         private:
-            TTimeSlotPtr* timeSlots;
-            size_t size = 0;
-            size_t curTimeSlot = 0;
+            TLogRecord* Reserve();      // nullptr - кольцо заполнено
+            void Commit();
+            static void SetArg(TLogArg& arg, const char* value);
+            template<typename T> static void SetArg(TLogArg& arg, T value);
+            static void SetArgs(TLogRecord&, size_t);
+            template<typename T, typename... Rest> static void SetArgs(TLogRecord& record, size_t i, T value, Rest... rest);
+            static size_t FormatNumber(char* line, size_t pos, size_t size, unsigned long value, bool negative, unsigned base, size_t width, char fill);
+
+            TLogRecord records[SIZE];
+            uint32_t head;      // Пишет только Write
+            uint32_t tail;      // Пишет только Flush
+            uint32_t dropped;
     };
 
-    inline TTimeSlotChain::TTimeSlotChain(const std::initializer_list<TTimeSlot>& ts) {
-        size = ts.size();
-        timeSlots = new TTimeSlotPtr[size];
+    inline TDeferredLog::TDeferredLog()
+        : head(0)
+        , tail(0)
+        , dropped(0) {
+    }
+    inline TLogRecord* TDeferredLog::Reserve() {
+        uint32_t h = head;
+        if (h - AtomicLoad(tail) >= SIZE) {
+            AtomicStore(dropped, dropped + 1);
+            return nullptr;
+        }
+        return &records[h & (SIZE - 1)];
+    }
+    inline void TDeferredLog::Commit() {
+        // Запись становится видна читателю только после заполнения
+        AtomicStore(head, head + 1);
+    }
+    inline void TDeferredLog::Log(const char* logLine) {
+        if (LOG_ERROR > MTLOOP_LOG_LEVEL)
+            return;
+        TLogRecord* record = Reserve();
+        if (record == nullptr)
+            return;
+        record->format = "%s";
+        record->argc = LOG_TEXT_RECORD;
         size_t i = 0;
-        for (const auto& item : ts) {
-            timeSlots[i++] = item.Clone();
+        for (; logLine[i] != '\0' && i + 1 < sizeof(record->text); ++i)
+            record->text[i] = logLine[i];
+        record->text[i] = '\0';
+        Commit();
+    }
+    template<TLogLevel Level, typename... Args>
+    inline void TDeferredLog::Write(const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= MTLOOP_LOG_ARGS, "too many log arguments, raise MTLOOP_LOG_ARGS");
+        if (Level > MTLOOP_LOG_LEVEL)
+            return;
+        TLogRecord* record = Reserve();
+        if (record == nullptr)
+            return;
+        record->format = format;
+        record->argc = sizeof...(Args);
+        SetArgs(*record, 0, args...);
+        Commit();
+    }
+    inline size_t TDeferredLog::Flush(TLog& sink) {
+        return FlushTo([&sink](const char* line) { sink.Log(line); });
+    }
+    template<typename TSink>
+    inline size_t TDeferredLog::FlushTo(TSink sink) {
+        char line[MTLOOP_LOG_LINE];
+        uint32_t t = tail;
+        uint32_t h = AtomicLoad(head);
+        size_t done = 0;
+        for (; t != h; ++t, ++done) {
+            Format(records[t & (SIZE - 1)], line, sizeof(line));
+            // Место освобождается до вывода: писатель не ждет медленный вывод
+            AtomicStore(tail, t + 1);
+            sink(static_cast<const char*>(line));
         }
+        return done;
     }
-    inline TTimeSlotChain::~TTimeSlotChain() {
-        for (size_t i = 0; i < size; ++i) {
-            delete timeSlots[i];
+    inline size_t TDeferredLog::GetPending() {
+        return AtomicLoad(head) - AtomicLoad(tail);
+    }
+    inline uint32_t TDeferredLog::GetDropped() {
+        return AtomicLoad(dropped);
+    }
+    inline void TDeferredLog::SetArg(TLogArg& arg, const char* value) {
+        arg.str = value;
+    }
+    template<typename T>
+    inline void TDeferredLog::SetArg(TLogArg& arg, T value) {
+        // Изменяемый буфер почти всегда на стеке и не доживет до Flush()
+        static_assert(!TIsSame<T, char*>::value, "Write() keeps only the %s pointer; copy a char buffer with Log()");
+        arg.value = static_cast<long>(value);
+    }
+    inline void TDeferredLog::SetArgs(TLogRecord&, size_t) {
+    }
+    template<typename T, typename... Rest>
+    inline void TDeferredLog::SetArgs(TLogRecord& record, size_t i, T value, Rest... rest) {
+        SetArg(record.args[i], value);
+        SetArgs(record, i + 1, rest...);
+    }
+    inline size_t TDeferredLog::FormatNumber(char* line, size_t pos, size_t size, unsigned long value, bool negative, unsigned base, size_t width, char fill) {
+        char digits[3 * sizeof(long) + 1];
+        size_t n = 0;
+        do {
+            unsigned digit = value % base;
+            digits[n++] = static_cast<char>(digit < 10 ? '0' + digit : 'a' + digit - 10);
+            value /= base;
+        } while (value != 0);
+        size_t length = n + (negative ? 1 : 0);
+        if (negative && fill == '0' && pos + 1 < size)
+            line[pos++] = '-';
+        for (; width > length && pos + 1 < size; --width)
+            line[pos++] = fill;
+        if (negative && fill != '0' && pos + 1 < size)
+            line[pos++] = '-';
+        while (n > 0 && pos + 1 < size)
+            line[pos++] = digits[--n];
+        return pos;
+    }
+    inline size_t TDeferredLog::Format(const TLogRecord& record, char* line, size_t size) {
+        if (record.argc == LOG_TEXT_RECORD) {
+            size_t pos = 0;
+            for (; record.text[pos] != '\0' && pos + 1 < size; ++pos)
+                line[pos] = record.text[pos];
+            line[pos] = '\0';
+            return pos;
+        }
+        size_t pos = 0;
+        size_t arg = 0;
+        for (const char* f = record.format; *f != '\0' && pos + 1 < size; ++f) {
+            if (*f != '%') {
+                line[pos++] = *f;
+                continue;
+            }
+            ++f;
+            char fill = ' ';
+            if (*f == '0') {
+                fill = '0';
+                ++f;
+            }
+            size_t width = 0;
+            for (; *f >= '0' && *f <= '9'; ++f)
+                width = width * 10 + (*f - '0');
+            while (*f == 'l')
+                ++f;
+            if (*f == '\0')
+                break;
+            if (*f == '%') {
+                line[pos++] = '%';
+                continue;
+            }
+            if (arg >= record.argc) {
+                line[pos++] = '?';
+                continue;
+            }
+            const TLogArg& value = record.args[arg++];
+            switch (*f) {
+                case 'd':
+                case 'i':
+                    pos = FormatNumber(line, pos, size, value.value < 0 ? 0UL - static_cast<unsigned long>(value.value) : value.value,
+                                       value.value < 0, 10, width, fill);
+                    break;
+                case 'u':
+                    pos = FormatNumber(line, pos, size, value.value, false, 10, width, fill);
+                    break;
+                case 'x':
+                    pos = FormatNumber(line, pos, size, value.value, false, 16, width, fill);
+                    break;
+                case 'c':
+                    line[pos++] = static_cast<char>(value.value);
+                    break;
+                case 's':
+                    for (const char* str = value.str != nullptr ? value.str : "(null)"; *str != '\0' && pos + 1 < size; ++str)
+                        line[pos++] = *str;
+                    break;
+                default:
+                    line[pos++] = '?';
+                    break;
+            }
         }
-        delete[] timeSlots;
+        line[pos] = '\0';
+        return pos;
     }
-    inline bool TTimeSlotChain::Run(TLog& log) {
-        TTimeSlot* ts = timeSlots[curTimeSlot];
-        if (ts->Run(log)) {
-             curTimeSlot = (curTimeSlot + 1) % size;
-             timeSlots[curTimeSlot]->SetStartTime(ts->GetRTime() + 1);
-             return true;
-        };
-        return false;
+
+
+    // ///////////////////////// //
+    //       TLoopCommand        //
+    // ///////////////////////// //
+    // Команда перенастройки TLoop из другого потока или обработчика прерывания.
+    // Память команды принадлежит отправителю: команду нельзя разрушать или
+    // отправлять повторно, пока IsDone() не вернет true.
+    enum TCommandKind {
+        COMMAND_ATTACH,         // Attach(chain)
+        COMMAND_DETACH,         // Detach(chain)
+        COMMAND_SET_POLICY,     // SetDispatchPolicy(policy)
+        COMMAND_CALL            // Вызов задачи в потоке TLoop
+    };
+
+    // Дескриптор цепочки в TLoop: поколение места и номер места
+    using TChainHandle = uint32_t;
+    const TChainHandle INVALID_CHAIN = 0;
+
+    class TLoopCommand {
+        public:
+            TLoopCommand(TCommandKind kind, IChain& chain);
+            TLoopCommand(TDispatchPolicy policy);
+            TLoopCommand(const TCallable& call);
+            bool IsDone();
+            bool GetResult() const;     // Результат Attach/Detach/вызова
+            TChainHandle GetHandle() const;  // Дескриптор, выданный Attach
+        private:
+            friend class TLoop;
+
+            TCommandKind kind;
+            IChain* chain;
+            TDispatchPolicy policy;
+            TCallable call;
+            TLoopCommand* next;
+            TChainHandle handle;
+            bool done;
+            bool result;
+    };
+
+    inline TLoopCommand::TLoopCommand(TCommandKind kind, IChain& chain)
+        : kind(kind)
+        , chain(&chain)
+        , policy(DISPATCH_DEADLINE)
+        , next(nullptr)
+        , handle(INVALID_CHAIN)
+        , done(false)
+        , result(false) {
+    }
+    inline TLoopCommand::TLoopCommand(TDispatchPolicy policy)
+        : kind(COMMAND_SET_POLICY)
+        , chain(nullptr)
+        , policy(policy)
+        , next(nullptr)
+        , handle(INVALID_CHAIN)
+        , done(false)
+        , result(false) {
+    }
+    inline TLoopCommand::TLoopCommand(const TCallable& call)
+        : kind(COMMAND_CALL)
+        , chain(nullptr)
+        , policy(DISPATCH_DEADLINE)
+        , call(call)
+        , next(nullptr)
+        , handle(INVALID_CHAIN)
+        , done(false)
+        , result(false) {
+    }
+    inline bool TLoopCommand::IsDone() {
+        return AtomicLoad(done);
+    }
+    inline bool TLoopCommand::GetResult() const {
+        return result;
+    }
+    inline TChainHandle TLoopCommand::GetHandle() const {
+        return handle;
     }
 
 
@@ -437,43 +2589,772 @@ namespace MT {
     //          TLoop            //
     // ///////////////////////// //
     using TTimeSlotChainPtr = TTimeSlotChain *;
+    struct TChainRef {
+        IChain* chain;      // nullptr - место свободно
+        bool owned;         // Цепочку создал и разрушает TLoop
+        uint16_t gen;       // Поколение - защита от устаревших дескрипторов
+        bool ready;         // Цепочка в куче готовых (DISPATCH_PRIORITY)
+        size_t nextFree;    // Следующее свободное место
+    };
+    const size_t MAX_CHAIN_COUNT = 0xFFFF;
+    // Итог RunBatch(): выполнено задач и ближайший срок после пачки
+    struct TBatchResult {
+        size_t done;
+        tick_t nextWakeTime;
+    };
     static TLog defaultLog;
     class TLoop {
         public:
-            TLoop(size_t count = DEFAULT_SLOT_CHAIN_COUNT, TLog& log = defaultLog);
-            ~TLoop();
-            bool Attach(const std::initializer_list<TTimeSlot>& ts);
+            TLoop(size_t count = DEFAULT_SLOT_CHAIN_COUNT, TLog& log = defaultLog, TDispatchPolicy policy = DISPATCH_ROUND_ROBIN);
+            virtual ~TLoop();
+            TChainHandle Attach(const std::initializer_list<TTimeSlot>& ts);
+            TChainHandle Attach(IChain& chain);
+            bool Detach(TChainHandle handle);
+            bool Detach(IChain& chain);
+            IChain* GetChain(TChainHandle handle);
+            void Submit(TLoopCommand& command);
+            size_t GetChainCount() const;
+            TTimerHandle PostAt(tick_t time, const TCallable& task);
+            TTimerHandle PostAfter(tick_t delay, const TCallable& task);
+            bool Cancel(TTimerHandle handle);
             bool Run();
-        private:
+            size_t RunUntilIdle();
+            // Подряд все тайм-слоты, готовые к началу пачки, в порядке политики,
+            // пока не истек budget тиков от начала пачки (0 - без ограничения).
+            // При DISPATCH_ROUND_ROBIN порядок - по кругу по номерам цепочек, а не по срокам
+            TBatchResult RunBatch(tick_t budget = 0);
+            template<typename TSleeper> size_t WaitAndRun(TSleeper sleepUntil);
+            tick_t NextWakeTime();
+            void SetDispatchPolicy(TDispatchPolicy policy);
+            TDispatchPolicy GetDispatchPolicy() const;
+            bool SetPriority(TChainHandle handle, uint8_t priority);
+            uint8_t GetPriority(TChainHandle handle);
+        protected:
+            // Таблица цепочек и куча размещаются во внешней памяти на count цепочек
+            TLoop(TChainRef* chains, TChainHeap::TEntry* heapEntries, size_t count, TLog& log, TDispatchPolicy policy);
+            virtual IChain* CreateChain(size_t id, const std::initializer_list<TTimeSlot>& ts);
+            virtual void DestroyChain(size_t id);
+            // Вызывается в потоке отправителя после Submit(): планировщик,
+            // который спит в ожидании событий, должен проснуться
+            virtual void OnSubmit();
+            size_t Sources() const;         // Подключенные цепочки и колесо с таймерами
+
+            TChainRef* chains;
+            size_t size;
+            TTimerWheel* timers;
             TLog& log;
-            TTimeSlotChainPtr* timeSlotChains;
+        private:
+            static const size_t NO_CHAIN_ID = static_cast<size_t>(-1);
+
+            size_t TakeId();
+            bool Grow();
+            void ReleaseId(size_t id);
+            size_t IdOf(TChainHandle handle) const;
+            TChainHandle AttachChain(size_t id, IChain* chain, bool owned);
+            void DetachChain(size_t id);
+            void RunCommands();
+            bool Execute(TLoopCommand& command);
+            bool RunPass(tick_t tm);
+            bool RunRoundRobin(tick_t tm);
+            bool RunDeadline(tick_t tm);
+            bool RunPriority(tick_t tm);
+            tick_t TopDeadline() const;
+            tick_t WakeTime();
+            bool RunChain(size_t id, tick_t tm, bool& result);
+
+            TChainHeap::TEntry* heapEntries;
+            TChainHeap chainHeap;
+            TReadyChainHeap readyHeap;      // Готовые цепочки DISPATCH_PRIORITY
+            TDispatchPolicy policy;
+            bool ownsStorage;
             size_t count;
-            size_t size;
+            size_t attached;                // Подключенные цепочки, без дыр
+            size_t freeId;                  // Список свободных мест
             size_t curTimeSlotChain;
+            TLoopCommand* commands;         // Стек отправленных команд
+            size_t runningId;               // Цепочка, задача которой сейчас выполняется
+            bool detachPending;             // Она отсоединила себя - отсоединить после Run
     };
 
-    inline TLoop::TLoop(size_t count, TLog& log)
-        : log(log)
-        , count(count)
+    inline TLoop::TLoop(size_t count, TLog& log, TDispatchPolicy policy)
+        : TLoop(new TChainRef[count], new TChainHeap::TEntry[count], count, log, policy) {
+        ownsStorage = true;
+    }
+    inline TLoop::TLoop(TChainRef* chains, TChainHeap::TEntry* heapEntries, size_t count, TLog& log, TDispatchPolicy policy)
+        : chains(chains)
         , size(0)
-        , curTimeSlotChain(0) {
-        timeSlotChains = new TTimeSlotChainPtr[size];
+        , timers(nullptr)
+        , log(log)
+        , heapEntries(heapEntries)
+        , chainHeap(heapEntries)
+        , readyHeap(heapEntries, count)
+        , policy(policy)
+        , ownsStorage(false)
+        , count(count)
+        , attached(0)
+        , freeId(NO_CHAIN_ID)
+        , curTimeSlotChain(0)
+        , commands(nullptr)
+        , runningId(NO_CHAIN_ID)
+        , detachPending(false) {
     }
     inline TLoop::~TLoop() {
+        // Цепочки во внешней памяти разрушает владелец памяти
+        if (!ownsStorage)
+            return;
+        for (size_t i = 0; i < size; ++i)
+            if (chains[i].owned)
+                delete chains[i].chain;
+        delete[] chains;
+        delete[] heapEntries;
+        delete timers;
+    }
+    inline IChain* TLoop::CreateChain(size_t id, const std::initializer_list<TTimeSlot>& ts) {
+        return new TTimeSlotChain(ts);
+    }
+    inline void TLoop::DestroyChain(size_t id) {
+        delete chains[id].chain;
+    }
+    inline size_t TLoop::TakeId() {
+        // Место отсоединенной цепочки занимает новая, остальные не сдвигаются
+        if (freeId != NO_CHAIN_ID) {
+            size_t id = freeId;
+            freeId = chains[id].nextFree;
+            return id;
+        }
+        if (size >= MAX_CHAIN_COUNT || (size >= count && !Grow()))
+            return NO_CHAIN_ID;
+        chains[size].chain = nullptr;
+        chains[size].owned = false;
+        chains[size].gen = 1;
+        chains[size].ready = false;
+        return size++;
+    }
+    inline bool TLoop::Grow() {
+        // Своя память растет вдвое, внешняя (TFixedLoop) - нет. Обе кучи живут
+        // в heapEntries, и куча готовых занимает ее с конца, поэтому переносятся
+        // записи цепочек и позиции обеих куч
+        if (!ownsStorage)
+            return false;
+        size_t newCount = count > 0 ? count * 2 : 1;
+        if (newCount > MAX_CHAIN_COUNT)
+            newCount = MAX_CHAIN_COUNT;
+        TChainRef* newChains = new TChainRef[newCount];
+        TChainHeap::TEntry* newEntries = new TChainHeap::TEntry[newCount];
         for (size_t i = 0; i < size; ++i)
-            delete timeSlotChains[i];
-        delete[] timeSlotChains;
+            newChains[i] = chains[i];
+        for (size_t i = 0; i < count; ++i)
+            newEntries[i] = heapEntries[i];
+        chainHeap.Relocate(newEntries, newCount);
+        readyHeap.Relocate(newEntries, newCount);
+        delete[] chains;
+        delete[] heapEntries;
+        chains = newChains;
+        heapEntries = newEntries;
+        count = newCount;
+        return true;
+    }
+    inline void TLoop::ReleaseId(size_t id) {
+        chains[id].chain = nullptr;
+        chains[id].owned = false;
+        if (++chains[id].gen == 0)
+            chains[id].gen = 1;
+        chains[id].nextFree = freeId;
+        freeId = id;
+    }
+    inline size_t TLoop::IdOf(TChainHandle handle) const {
+        size_t id = handle & 0xFFFF;
+        if (id >= size || chains[id].chain == nullptr || chains[id].gen != (handle >> 16))
+            return NO_CHAIN_ID;
+        return id;
+    }
+    inline TChainHandle TLoop::Attach(const std::initializer_list<TTimeSlot>& ts) {
+        // У пустой цепочки нет текущего тайм-слота и срока
+        if (ts.size() == 0)
+            return INVALID_CHAIN;
+        size_t id = TakeId();
+        if (id == NO_CHAIN_ID)
+            return INVALID_CHAIN;
+        return AttachChain(id, CreateChain(id, ts), true);
+    }
+    inline TChainHandle TLoop::Attach(IChain& chain) {
+        size_t id = TakeId();
+        if (id == NO_CHAIN_ID)
+            return INVALID_CHAIN;
+        return AttachChain(id, &chain, false);
     }
-    inline bool TLoop::Attach(const std::initializer_list<TTimeSlot>& ts) {
-        if (size >= count)
+    inline TChainHandle TLoop::AttachChain(size_t id, IChain* chain, bool owned) {
+        if (chain == nullptr) {
+            ReleaseId(id);
+            return INVALID_CHAIN;
+        }
+        chains[id].chain = chain;
+        chains[id].owned = owned;
+        chains[id].ready = false;
+        chainHeap.Push(id, chain->GetLTime(), DEFAULT_CHAIN_PRIORITY);
+        attached++;
+        return (static_cast<TChainHandle>(chains[id].gen) << 16) | id;
+    }
+    inline void TLoop::DetachChain(size_t id) {
+        // Задача отсоединяет свою же цепочку: цепочка еще выполняется и
+        // стоит в куче, отсоединяем ее после выхода из Run
+        if (id == runningId) {
+            detachPending = true;
+            return;
+        }
+        if (chains[id].ready)
+            readyHeap.Remove(id);
+        else
+            chainHeap.Remove(id);
+        if (chains[id].owned)
+            DestroyChain(id);
+        attached--;
+        ReleaseId(id);
+    }
+    inline bool TLoop::Detach(TChainHandle handle) {
+        size_t id = IdOf(handle);
+        if (id == NO_CHAIN_ID)
+            return false;
+        DetachChain(id);
+        return true;
+    }
+    inline bool TLoop::Detach(IChain& chain) {
+        for (size_t id = 0; id < size; ++id) {
+            if (chains[id].chain == &chain) {
+                DetachChain(id);
+                return true;
+            }
+        }
+        return false;
+    }
+    inline IChain* TLoop::GetChain(TChainHandle handle) {
+        size_t id = IdOf(handle);
+        return id == NO_CHAIN_ID ? nullptr : chains[id].chain;
+    }
+    inline size_t TLoop::GetChainCount() const {
+        return attached;
+    }
+    inline bool TLoop::SetPriority(TChainHandle handle, uint8_t priority) {
+        size_t id = IdOf(handle);
+        if (id == NO_CHAIN_ID)
             return false;
-        timeSlotChains[size++] = new TTimeSlotChain(ts);
+        if (chains[id].ready)
+            readyHeap.SetPriority(id, priority);
+        else
+            chainHeap.SetPriority(id, priority);
         return true;
     }
+    inline uint8_t TLoop::GetPriority(TChainHandle handle) {
+        size_t id = IdOf(handle);
+        return id == NO_CHAIN_ID ? DEFAULT_CHAIN_PRIORITY : chainHeap.GetPriority(id);
+    }
+    inline void TLoop::Submit(TLoopCommand& command) {
+        // Стек Трайбера: отправители не блокируют друг друга и поток TLoop
+        command.done = false;
+        command.next = AtomicLoad(commands);
+        while (!AtomicCompareExchange(commands, command.next, &command)) {
+        }
+        OnSubmit();
+    }
+    inline void TLoop::OnSubmit() {
+    }
+    inline void TLoop::RunCommands() {
+        if (AtomicLoad(commands) == nullptr)
+            return;
+        TLoopCommand* stack = AtomicExchange(commands, static_cast<TLoopCommand*>(nullptr));
+        // Стек разворачиваем, чтобы выполнить команды в порядке отправки
+        TLoopCommand* queue = nullptr;
+        while (stack != nullptr) {
+            TLoopCommand* next = stack->next;
+            stack->next = queue;
+            queue = stack;
+            stack = next;
+        }
+        while (queue != nullptr) {
+            TLoopCommand* command = queue;
+            // После done отправитель может снова использовать команду
+            queue = command->next;
+            command->result = Execute(*command);
+            AtomicStore(command->done, true);
+        }
+    }
+    inline bool TLoop::Execute(TLoopCommand& command) {
+        switch (command.kind) {
+            case COMMAND_ATTACH:
+                command.handle = Attach(*command.chain);
+                return command.handle != INVALID_CHAIN;
+            case COMMAND_DETACH:
+                return Detach(*command.chain);
+            case COMMAND_SET_POLICY:
+                SetDispatchPolicy(command.policy);
+                return true;
+            case COMMAND_CALL:
+                return command.call(log);
+        }
+        return false;
+    }
+    inline TTimerHandle TLoop::PostAt(tick_t time, const TCallable& task) {
+        if (timers == nullptr) {
+            // Колесо таймеров во внешней памяти может отсутствовать
+            if (!ownsStorage)
+                return INVALID_TIMER;
+            timers = new TTimerWheel(DEFAULT_TIMER_COUNT, TTimer::GetTime());
+        }
+        return timers->Post(time, task);
+    }
+    inline TTimerHandle TLoop::PostAfter(tick_t delay, const TCallable& task) {
+        return PostAt(TTimer::GetTime() + delay, task);
+    }
+    inline bool TLoop::Cancel(TTimerHandle handle) {
+        return timers != nullptr && timers->Cancel(handle);
+    }
+    inline size_t TLoop::Sources() const {
+        return attached + (timers != nullptr && timers->Pending() > 0 ? 1 : 0);
+    }
+    inline void TLoop::SetDispatchPolicy(TDispatchPolicy newPolicy) {
+        if (policy == DISPATCH_PRIORITY && newPolicy != DISPATCH_PRIORITY) {
+            // Готовые цепочки возвращаются в общую кучу со своими ключами
+            while (readyHeap.Size() > 0) {
+                size_t id = readyHeap.Top();
+                tick_t deadline = readyHeap.TopDeadline();
+                readyHeap.Remove(id);
+                chainHeap.Push(id, deadline);
+                chains[id].ready = false;
+            }
+        }
+        if (policy == DISPATCH_ROUND_ROBIN && newPolicy != DISPATCH_ROUND_ROBIN) {
+            // В режиме round-robin ключи кучи не обновляются - освежаем
+            for (size_t i = 0; i < size; ++i)
+                if (chains[i].chain != nullptr)
+                    chainHeap.Update(i, chains[i].chain->GetLTime());
+        }
+        policy = newPolicy;
+    }
+    inline TDispatchPolicy TLoop::GetDispatchPolicy() const {
+        return policy;
+    }
     inline bool TLoop::Run() {
-        bool result = timeSlotChains[curTimeSlotChain]->Run(log);
+        RunCommands();
+        return RunPass(TTimer::GetTime());
+    }
+    inline bool TLoop::RunPass(tick_t tm) {
+        // Время читается один раз на проход и передается цепочке и задаче
+        if (timers != nullptr && timers->Pending() > 0) {
+            timers->Advance(tm);
+            // Разовая задача идет в общем порядке сроков с цепочками
+            if (timers->HasReady() && (attached == 0 || policy == DISPATCH_ROUND_ROBIN
+                    || !TimeAfter(timers->ReadyTime(), TopDeadline())))
+                return timers->RunReady(log, tm);
+        }
+        if (attached == 0)
+            return false;
+        if (policy == DISPATCH_DEADLINE)
+            return RunDeadline(tm);
+        if (policy == DISPATCH_PRIORITY)
+            return RunPriority(tm);
+        return RunRoundRobin(tm);
+    }
+    inline tick_t TLoop::NextWakeTime() {
+        RunCommands();
+        return WakeTime();
+    }
+    inline tick_t TLoop::WakeTime() {
+        bool hasTimers = timers != nullptr && timers->Pending() > 0;
+        if (attached == 0)
+            return hasTimers ? timers->NextTime() : TTimer::GetTime();
+        tick_t wakeTime;
+        if (policy != DISPATCH_ROUND_ROBIN) {
+            wakeTime = TopDeadline();
+        } else {
+            bool found = false;
+            for (size_t i = 0; i < size; ++i) {
+                if (chains[i].chain == nullptr)
+                    continue;
+                tick_t lTime = chains[i].chain->GetLTime();
+                if (!found || TimeBefore(lTime, wakeTime))
+                    wakeTime = lTime;
+                found = true;
+            }
+        }
+        if (hasTimers && TimeBefore(timers->NextTime(), wakeTime))
+            wakeTime = timers->NextTime();
+        return wakeTime;
+    }
+    inline size_t TLoop::RunUntilIdle() {
+        // Останавливаемся, когда ни одна цепочка или таймер не готовы, либо когда
+        // все источники подряд отказались выполняться (задачи вернули false)
+        RunCommands();
+        size_t done = 0;
+        size_t idle = 0;
+        while (idle < Sources()) {
+            tick_t tm = TTimer::GetTime();
+            if (TimeAfter(NextWakeTime(), tm))
+                break;
+            if (RunPass(tm)) {
+                done++;
+                idle = 0;
+            } else {
+                idle++;
+            }
+        }
+        return done;
+    }
+    inline TBatchResult TLoop::RunBatch(tick_t budget) {
+        // Команды разбираются один раз на пачку. Пачка берет только тайм-слоты,
+        // готовые к ее началу: иначе при коротких тайм-слотах и настоящем
+        // таймере она бы не заканчивалась. Время перечитывается после каждой
+        // выполненной задачи - для следующей задачи и бюджета.
+        RunCommands();
+        TBatchResult result;
+        result.done = 0;
+        tick_t start = TTimer::GetTime();
+        tick_t tm = start;
+        size_t idle = 0;
+        for (;;) {
+            if (RunPass(tm)) {
+                result.done++;
+                idle = 0;
+                tick_t now = TTimer::GetTime();
+                if (budget > 0 && static_cast<tick_t>(now - start) >= budget)
+                    break;
+                // Пока таймер не сдвинулся, готовность проверяет сам RunPass: на
+                // грубом таймере (micros() с шагом 4 мкс) это экономит WakeTime()
+                if (now != tm && TimeAfter(WakeTime(), start))
+                    break;
+                tm = now;
+            } else if (++idle >= Sources() || TimeAfter(WakeTime(), start)) {
+                break;
+            }
+        }
+        result.nextWakeTime = WakeTime();
+        return result;
+    }
+    template<typename TSleeper>
+    inline size_t TLoop::WaitAndRun(TSleeper sleepUntil) {
+        tick_t wakeTime = NextWakeTime();
+        if (TimeBefore(TTimer::GetTime(), wakeTime))
+            sleepUntil(wakeTime);
+        return RunUntilIdle();
+    }
+    // Запуск цепочки id. Возвращает false, если задача отсоединила свою
+    // цепочку или цепочка завершилась: та уже отсоединена, ее место и куча
+    // трогать нельзя
+    inline bool TLoop::RunChain(size_t id, tick_t tm, bool& result) {
+        TraceChain(id);
+        runningId = id;
+        result = chains[id].chain->Run(log, tm);
+        runningId = NO_CHAIN_ID;
+        if (!detachPending && !chains[id].chain->IsFinished())
+            return true;
+        detachPending = false;
+        DetachChain(id);
+        return false;
+    }
+    inline bool TLoop::RunRoundRobin(tick_t tm) {
+        while (chains[curTimeSlotChain].chain == nullptr)
+            curTimeSlotChain = (curTimeSlotChain + 1) % size;
+        bool result;
+        RunChain(curTimeSlotChain, tm, result);
         curTimeSlotChain = (curTimeSlotChain + 1) % size;
         return result;
     }
-}
+    inline bool TLoop::RunDeadline(tick_t tm) {
+        size_t id = chainHeap.Top();
+        if (TimeBefore(tm, chainHeap.TopDeadline()))
+            return false;
+        bool result;
+        if (!RunChain(id, tm, result))
+            return result;
+        // Цепочка, задача которой не выполнилась, встает в очередь за уже
+        // просроченными цепочками, чтобы не блокировать их
+        chainHeap.Update(id, result ? chains[id].chain->GetLTime() : tm);
+        return result;
+    }
+    inline bool TLoop::RunPriority(tick_t tm) {
+        // Цепочки с наступившим сроком переходят в кучу готовых, где старший
+        // класс приоритета обгоняет младшие независимо от опоздания
+        while (chainHeap.Size() > 0 && !TimeBefore(tm, chainHeap.TopDeadline())) {
+            size_t id = chainHeap.Top();
+            tick_t deadline = chainHeap.TopDeadline();
+            chainHeap.Remove(id);
+            readyHeap.Push(id, deadline);
+            chains[id].ready = true;
+        }
+        if (readyHeap.Size() == 0)
+            return false;
+        size_t id = readyHeap.Top();
+        bool result;
+        if (!RunChain(id, tm, result))
+            return result;
+        readyHeap.Remove(id);
+        chains[id].ready = false;
+        // Отказавшая цепочка уступает готовым цепочкам младших классов
+        // до следующего тика, иначе она бы их не пропускала
+        chainHeap.Push(id, result ? chains[id].chain->GetLTime() : tm + 1);
+        return result;
+    }
+    inline tick_t TLoop::TopDeadline() const {
+        return readyHeap.Size() > 0 ? readyHeap.TopDeadline() : chainHeap.TopDeadline();
+    }
+
+
+    // ///////////////////////// //
+    //        TFixedLoop         //
+    // ///////////////////////// //
+    // Планировщик не более чем на MaxChains цепочек по MaxSlots тайм-слотов
+    // и MaxTimers разовых задач. Цепочки, тайм-слоты, адаптеры и таймеры
+    // размещаются внутри объекта, куча не используется. Attach() возвращает
+    // INVALID_CHAIN, если емкости не хватает.
+    template<size_t MaxTimers>
+    struct TFixedTimers {
+        TTimerWheel::TNode nodes[MaxTimers];
+        TTimerWheel wheel;
+
+        TFixedTimers(): wheel(nodes, MaxTimers, TTimer::GetTime()) {
+        }
+        TTimerWheel* Get() {
+            return &wheel;
+        }
+    };
+    template<>
+    struct TFixedTimers<0> {
+        TTimerWheel* Get() {
+            return nullptr;
+        }
+    };
+
+    template<size_t MaxChains, size_t MaxSlots, size_t MaxTimers = 0>
+    class TFixedLoop: public TLoop {
+        public:
+            TFixedLoop(TLog& log = defaultLog, TDispatchPolicy policy = DISPATCH_ROUND_ROBIN);
+            ~TFixedLoop();
+        protected:
+            IChain* CreateChain(size_t id, const std::initializer_list<TTimeSlot>& ts) override;
+            void DestroyChain(size_t id) override;
+        private:
+            using TChain = TFixedTimeSlotChain<MaxSlots>;
+            struct alignas(TChain) TChainStorage {
+                unsigned char data[sizeof(TChain)];
+            };
+
+            TChainRef chainRefs[MaxChains];
+            TChainHeap::TEntry heapEntries[MaxChains];
+            TChainStorage chainStorage[MaxChains];
+            TFixedTimers<MaxTimers> fixedTimers;
+    };
+
+    template<size_t MaxChains, size_t MaxSlots, size_t MaxTimers>
+    inline TFixedLoop<MaxChains, MaxSlots, MaxTimers>::TFixedLoop(TLog& log, TDispatchPolicy policy)
+        : TLoop(chainRefs, heapEntries, MaxChains, log, policy) {
+        timers = fixedTimers.Get();
+    }
+    template<size_t MaxChains, size_t MaxSlots, size_t MaxTimers>
+    inline TFixedLoop<MaxChains, MaxSlots, MaxTimers>::~TFixedLoop() {
+        for (size_t i = 0; i < size; ++i)
+            if (chains[i].owned)
+                chains[i].chain->~IChain();
+    }
+    template<size_t MaxChains, size_t MaxSlots, size_t MaxTimers>
+    inline IChain* TFixedLoop<MaxChains, MaxSlots, MaxTimers>::CreateChain(size_t id, const std::initializer_list<TTimeSlot>& ts) {
+        if (ts.size() > MaxSlots)
+            return nullptr;
+        return new (&chainStorage[id]) TChain(ts);
+    }
+    template<size_t MaxChains, size_t MaxSlots, size_t MaxTimers>
+    inline void TFixedLoop<MaxChains, MaxSlots, MaxTimers>::DestroyChain(size_t id) {
+        chains[id].chain->~IChain();
+    }
+
+
+    // ///////////////////////// //
+    //        TStaticSlot        //
+    // ///////////////////////// //
+    // Тайм-слот, известный на этапе компиляции: задача и длительности - параметры
+    // шаблона, попадают в код константами и вызываются напрямую
+    template<callbackPtr Task, tick_t MinDuration = DEFAULT_SLOT_MIN_DURATION, tick_t Padding = DEFAULT_SLOT_PADDING>
+    struct TStaticSlot {
+        static constexpr tick_t MIN_DURATION = MinDuration;
+        static constexpr tick_t PADDING = Padding;
+        static bool Run(TLog& log) {
+            return Task(log);
+        }
+    };
+
+    template<callbackDummyPtr Task, tick_t MinDuration = DEFAULT_SLOT_MIN_DURATION, tick_t Padding = DEFAULT_SLOT_PADDING>
+    struct TStaticDummySlot {
+        static constexpr tick_t MIN_DURATION = MinDuration;
+        static constexpr tick_t PADDING = Padding;
+        static bool Run(TLog&) {
+            Task();
+            return true;
+        }
+    };
+
+
+    // ///////////////////////// //
+    //       TStaticChain        //
+    // ///////////////////////// //
+    // Цепочка из TStaticSlot. В памяти хранится только номер текущего тайм-слота,
+    // время его начала и статистика; задачи вызываются без виртуальной диспетчеризации.
+    // Подключается к TLoop через IChain наравне с TTimeSlotChain.
+    template<typename... Slots>
+    class TStaticChain final: public IChain {
+        public:
+            static constexpr size_t SIZE = sizeof...(Slots);
+            static_assert(SIZE > 0, "TStaticChain needs at least one slot");
+
+            bool Run(TLog& log) override;
+            bool Run(TLog& log, tick_t tm) override;
+            tick_t GetLTime() override;
+            TStat& GetStat(size_t slot);
+        private:
+            template<size_t I, typename Slot, typename... Rest> bool RunFrom(TLog& log, tick_t tm);
+            template<size_t I> bool RunFrom(TLog& log, tick_t tm);
+            template<size_t I, typename Slot> bool RunSlot(TLog& log, tick_t tm);
+
+            size_t curTimeSlot = 0;
+            tick_t slotStartTime = 1;
+            TStat stats[SIZE];
+    };
+
+    template<typename... Slots>
+    inline bool TStaticChain<Slots...>::Run(TLog& log) {
+        return Run(log, TTimer::GetTime());
+    }
+    template<typename... Slots>
+    inline bool TStaticChain<Slots...>::Run(TLog& log, tick_t tm) {
+        if (TimeBefore(tm, slotStartTime))
+            return false;
+        return RunFrom<0, Slots...>(log, tm);
+    }
+    template<typename... Slots>
+    inline tick_t TStaticChain<Slots...>::GetLTime() {
+        return slotStartTime;
+    }
+    template<typename... Slots>
+    inline TStat& TStaticChain<Slots...>::GetStat(size_t slot) {
+        return stats[slot];
+    }
+    template<typename... Slots>
+    template<size_t I, typename Slot, typename... Rest>
+    inline bool TStaticChain<Slots...>::RunFrom(TLog& log, tick_t tm) {
+        if (curTimeSlot == I)
+            return RunSlot<I, Slot>(log, tm);
+        return RunFrom<I + 1, Rest...>(log, tm);
+    }
+    template<typename... Slots>
+    template<size_t I>
+    inline bool TStaticChain<Slots...>::RunFrom(TLog& log, tick_t tm) {
+        return false;
+    }
+    template<typename... Slots>
+    template<size_t I, typename Slot>
+    inline bool TStaticChain<Slots...>::RunSlot(TLog& log, tick_t tm) {
+        TStat& stat = stats[I];
+        TraceSlot(I);
+        if (!Slot::Run(log)) {
+            TraceDecline(slotStartTime, tm);
+            return false;
+        }
+        tick_t stopTime = TTimer::GetTime();
+        stat.SetStartTime(tm);
+        stat.SetStopTime(stopTime);
+        stat.Sample(slotStartTime);
+        TraceExecution(slotStartTime, tm, stopTime, true);
+        tick_t rTime = SlotRTime(stopTime, slotStartTime, Slot::MIN_DURATION, Slot::PADDING, true, stopTime);
+        curTimeSlot = (I + 1) % SIZE;
+        slotStartTime = rTime + 1;
+        return true;
+    }
 
+
+    // ///////////////////////// //
+    //        TStaticLoop        //
+    // ///////////////////////// //
+    // Планировщик для набора TStaticChain, известного на этапе компиляции.
+    // Цепочки хранятся внутри объекта и вызываются напрямую, порядок - как DISPATCH_DEADLINE.
+    template<typename... Chains> struct TStaticChainList {
+    };
+    template<typename Head, typename... Tail> struct TStaticChainList<Head, Tail...> {
+        Head head;
+        TStaticChainList<Tail...> tail;
+    };
+
+    template<size_t I, typename Head, typename... Tail> struct TStaticChainAt {
+        using type = typename TStaticChainAt<I - 1, Tail...>::type;
+        static type& Get(TStaticChainList<Head, Tail...>& list) {
+            return TStaticChainAt<I - 1, Tail...>::Get(list.tail);
+        }
+    };
+    template<typename Head, typename... Tail> struct TStaticChainAt<0, Head, Tail...> {
+        using type = Head;
+        static type& Get(TStaticChainList<Head, Tail...>& list) {
+            return list.head;
+        }
+    };
+
+    template<typename... Chains>
+    class TStaticLoop {
+        public:
+            static constexpr size_t SIZE = sizeof...(Chains);
+            static_assert(SIZE > 0, "TStaticLoop needs at least one chain");
+
+            TStaticLoop(TLog& log = defaultLog);
+            bool Run();
+            tick_t NextWakeTime();
+            template<size_t I> typename TStaticChainAt<I, Chains...>::type& GetChain();
+        private:
+            template<typename Head, typename... Tail>
+            static bool RunAt(TStaticChainList<Head, Tail...>& list, size_t id, TLog& log, tick_t tm, tick_t& lTime);
+            static bool RunAt(TStaticChainList<>& list, size_t id, TLog& log, tick_t tm, tick_t& lTime);
+
+            TLog& log;
+            TChainHeap::TEntry heapEntries[SIZE];
+            TChainHeap chainHeap;
+            TStaticChainList<Chains...> chains;
+    };
+
+    template<typename... Chains>
+    inline TStaticLoop<Chains...>::TStaticLoop(TLog& log)
+        : log(log)
+        , heapEntries()
+        , chainHeap(heapEntries) {
+        // Все цепочки начинают с первого тайм-слота, время начала у всех одинаковое
+        for (size_t i = 0; i < SIZE; ++i)
+            chainHeap.Push(i, chains.head.GetLTime());
+    }
+    template<typename... Chains>
+    inline bool TStaticLoop<Chains...>::Run() {
+        size_t id = chainHeap.Top();
+        tick_t tm = TTimer::GetTime();
+        if (TimeBefore(tm, chainHeap.TopDeadline()))
+            return false;
+        tick_t lTime = tm;
+        TraceChain(id);
+        bool result = RunAt(chains, id, log, tm, lTime);
+        chainHeap.Update(id, result ? lTime : tm);
+        return result;
+    }
+    template<typename... Chains>
+    inline tick_t TStaticLoop<Chains...>::NextWakeTime() {
+        return chainHeap.TopDeadline();
+    }
+    template<typename... Chains>
+    template<size_t I>
+    inline typename TStaticChainAt<I, Chains...>::type& TStaticLoop<Chains...>::GetChain() {
+        return TStaticChainAt<I, Chains...>::Get(chains);
+    }
+    template<typename... Chains>
+    template<typename Head, typename... Tail>
+    inline bool TStaticLoop<Chains...>::RunAt(TStaticChainList<Head, Tail...>& list, size_t id, TLog& log, tick_t tm, tick_t& lTime) {
+        if (id != 0)
+            return RunAt(list.tail, id - 1, log, tm, lTime);
+        bool result = list.head.Run(log, tm);
+        lTime = list.head.GetLTime();
+        return result;
+    }
+    template<typename... Chains>
+    inline bool TStaticLoop<Chains...>::RunAt(TStaticChainList<>& list, size_t id, TLog& log, tick_t tm, tick_t& lTime) {
+        return false;
+    }
+}
@@ -0,0 +1,259 @@
+/*
+ * MTParallelLoop.h
+ * Многопоточный планировщик для платформ с std::thread (Linux)
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace MT {
+
+    // ///////////////////////// //
+    //      TParallelLoop        //
+    // ///////////////////////// //
+    // Планировщик цепочек на нескольких рабочих потоках. У каждого потока своя
+    // куча цепочек по сроку (TChainHeap). Поток, у которого нет готовых цепочек,
+    // забирает самую просроченную цепочку у занятого потока, и дальше цепочка
+    // живет у него. Цепочка в каждый момент лежит не более чем в одной куче либо
+    // выполняется одним потоком, поэтому тайм-слоты одной цепочки не выполняются
+    // параллельно и не меняют порядок. Рабочие потоки не пишут в TraceBuffer().
+    // Лог один на все потоки и вызывается из них одновременно, поэтому должен
+    // быть потокобезопасным: TDeferredLog (один писатель) сюда не подходит.
+    // Attach() и Detach() работают только при остановленных потоках.
+    class TParallelLoop {
+        public:
+            TParallelLoop(size_t workerCount, size_t count = DEFAULT_SLOT_CHAIN_COUNT, TLog& log = defaultLog);
+            ~TParallelLoop();
+            TChainHandle Attach(const std::initializer_list<TTimeSlot>& ts);
+            TChainHandle Attach(IChain& chain);
+            bool Detach(TChainHandle handle);
+            bool Detach(IChain& chain);
+            void Start();
+            void Stop();
+            size_t GetWorkerCount() const;
+            uint64_t GetRunCount() const;
+            uint64_t GetStealCount() const;
+        private:
+            struct TWorker {
+                std::mutex mutex;               // Защищает chainHeap
+                TChainHeap* chainHeap;
+                std::atomic<bool> busy;         // Поток выполняет цепочку
+                std::atomic<uint64_t> runs;
+                std::atomic<uint64_t> steals;
+                std::thread thread;
+            };
+
+            static const size_t NO_CHAIN_ID = static_cast<size_t>(-1);
+
+            size_t TakeId();
+            TChainHandle AttachChain(size_t id, IChain* chain, bool owned);
+            void DetachChain(size_t id);
+            void WorkerLoop(size_t w);
+            bool RunLocal(size_t w);
+            bool Steal(size_t w);
+            bool RunChain(size_t w, size_t id, tick_t tm);
+
+            TLog& log;
+            TChainRef* chains;
+            size_t* homes;                      // Поток, в куче которого лежит цепочка
+            TWorker* workers;
+            size_t workerCount;
+            size_t count;
+            size_t size;
+            size_t freeId;                      // Список свободных мест
+            std::atomic<bool> running;
+    };
+
+    inline TParallelLoop::TParallelLoop(size_t workerCount, size_t count, TLog& log)
+        : log(log)
+        , chains(new TChainRef[count])
+        , homes(new size_t[count])
+        , workers(new TWorker[workerCount > 0 ? workerCount : 1])
+        , workerCount(workerCount > 0 ? workerCount : 1)
+        , count(count)
+        , size(0)
+        , freeId(NO_CHAIN_ID)
+        , running(false) {
+        for (size_t w = 0; w < this->workerCount; ++w) {
+            // Любая цепочка может перейти в любой поток
+            workers[w].chainHeap = new TChainHeap(count);
+            workers[w].busy = false;
+            workers[w].runs = 0;
+            workers[w].steals = 0;
+        }
+    }
+    inline TParallelLoop::~TParallelLoop() {
+        Stop();
+        for (size_t i = 0; i < size; ++i)
+            if (chains[i].owned)
+                delete chains[i].chain;
+        for (size_t w = 0; w < workerCount; ++w)
+            delete workers[w].chainHeap;
+        delete[] workers;
+        delete[] homes;
+        delete[] chains;
+    }
+    inline TChainHandle TParallelLoop::Attach(const std::initializer_list<TTimeSlot>& ts) {
+        if (ts.size() == 0 || running)
+            return INVALID_CHAIN;
+        size_t id = TakeId();
+        if (id == NO_CHAIN_ID)
+            return INVALID_CHAIN;
+        return AttachChain(id, new TTimeSlotChain(ts), true);
+    }
+    inline TChainHandle TParallelLoop::Attach(IChain& chain) {
+        if (running)
+            return INVALID_CHAIN;
+        size_t id = TakeId();
+        if (id == NO_CHAIN_ID)
+            return INVALID_CHAIN;
+        return AttachChain(id, &chain, false);
+    }
+    inline size_t TParallelLoop::TakeId() {
+        // Как в TLoop: место отсоединенной цепочки занимает новая
+        if (freeId != NO_CHAIN_ID) {
+            size_t id = freeId;
+            freeId = chains[id].nextFree;
+            return id;
+        }
+        if (size >= count || size >= MAX_CHAIN_COUNT)
+            return NO_CHAIN_ID;
+        chains[size].gen = 1;
+        return size++;
+    }
+    inline TChainHandle TParallelLoop::AttachChain(size_t id, IChain* chain, bool owned) {
+        chains[id].chain = chain;
+        chains[id].owned = owned;
+        // Начальное распределение - по кругу, дальше нагрузку выравнивает Steal
+        homes[id] = id % workerCount;
+        TWorker& worker = workers[homes[id]];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.chainHeap->Push(id, chain->GetLTime());
+        return (static_cast<TChainHandle>(chains[id].gen) << 16) | id;
+    }
+    inline bool TParallelLoop::Detach(TChainHandle handle) {
+        size_t id = handle & 0xFFFF;
+        if (running || id >= size || chains[id].chain == nullptr || chains[id].gen != (handle >> 16))
+            return false;
+        DetachChain(id);
+        return true;
+    }
+    inline bool TParallelLoop::Detach(IChain& chain) {
+        if (running)
+            return false;
+        for (size_t id = 0; id < size; ++id) {
+            if (chains[id].chain == &chain) {
+                DetachChain(id);
+                return true;
+            }
+        }
+        return false;
+    }
+    inline void TParallelLoop::DetachChain(size_t id) {
+        // Потоки стоят, поэтому homes и кучи не меняются. Завершенной цепочки
+        // в куче уже нет
+        if (!chains[id].chain->IsFinished())
+            workers[homes[id]].chainHeap->Remove(id);
+        if (chains[id].owned)
+            delete chains[id].chain;
+        chains[id].chain = nullptr;
+        chains[id].owned = false;
+        if (++chains[id].gen == 0)
+            chains[id].gen = 1;
+        chains[id].nextFree = freeId;
+        freeId = id;
+    }
+    inline void TParallelLoop::Start() {
+        if (running.exchange(true))
+            return;
+        for (size_t w = 0; w < workerCount; ++w)
+            workers[w].thread = std::thread(&TParallelLoop::WorkerLoop, this, w);
+    }
+    inline void TParallelLoop::Stop() {
+        running = false;
+        for (size_t w = 0; w < workerCount; ++w)
+            if (workers[w].thread.joinable())
+                workers[w].thread.join();
+    }
+    inline size_t TParallelLoop::GetWorkerCount() const {
+        return workerCount;
+    }
+    inline uint64_t TParallelLoop::GetRunCount() const {
+        uint64_t runs = 0;
+        for (size_t w = 0; w < workerCount; ++w)
+            runs += workers[w].runs.load(std::memory_order_relaxed);
+        return runs;
+    }
+    inline uint64_t TParallelLoop::GetStealCount() const {
+        uint64_t steals = 0;
+        for (size_t w = 0; w < workerCount; ++w)
+            steals += workers[w].steals.load(std::memory_order_relaxed);
+        return steals;
+    }
+    inline void TParallelLoop::WorkerLoop(size_t w) {
+        TraceThreadOff();
+        while (running.load(std::memory_order_relaxed)) {
+            if (RunLocal(w) || Steal(w))
+                continue;
+            std::this_thread::yield();
+        }
+    }
+    inline bool TParallelLoop::RunLocal(size_t w) {
+        TWorker& worker = workers[w];
+        tick_t tm = TTimer::GetTime();
+        size_t id;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            TChainHeap& heap = *worker.chainHeap;
+            if (heap.Size() == 0 || TimeBefore(tm, heap.TopDeadline()))
+                return false;
+            id = heap.Top();
+            heap.Remove(id);
+        }
+        return RunChain(w, id, tm);
+    }
+    inline bool TParallelLoop::Steal(size_t w) {
+        tick_t tm = TTimer::GetTime();
+        for (size_t i = 1; i < workerCount; ++i) {
+            TWorker& victim = workers[(w + i) % workerCount];
+            // Свободный поток сам возьмет свои готовые цепочки
+            if (!victim.busy.load(std::memory_order_relaxed))
+                continue;
+            size_t id;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                TChainHeap& heap = *victim.chainHeap;
+                if (heap.Size() == 0 || TimeBefore(tm, heap.TopDeadline()))
+                    continue;
+                id = heap.Top();
+                heap.Remove(id);
+            }
+            workers[w].steals.fetch_add(1, std::memory_order_relaxed);
+            return RunChain(w, id, tm);
+        }
+        return false;
+    }
+    inline bool TParallelLoop::RunChain(size_t w, size_t id, tick_t tm) {
+        TWorker& worker = workers[w];
+        IChain* chain = chains[id].chain;
+        worker.busy.store(true, std::memory_order_relaxed);
+        bool result = chain->Run(log, tm);
+        worker.busy.store(false, std::memory_order_relaxed);
+        if (result)
+            worker.runs.fetch_add(1, std::memory_order_relaxed);
+        // Завершенная цепочка в кучу не возвращается
+        if (chain->IsFinished())
+            return result;
+        // Как и в TLoop::RunDeadline, отказавшая цепочка встает за просроченными
+        tick_t deadline = result ? chain->GetLTime() : tm;
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.chainHeap->Push(id, deadline);
+        homes[id] = w;
+        return result;
+    }
+
+}
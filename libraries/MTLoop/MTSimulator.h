@@ -0,0 +1,299 @@
+/*
+ * MTSimulator.h
+ * Симуляция расписания на мок-таймере: время перескакивает к ближайшему сроку,
+ * длительности задач берутся из моделей
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef MTLOOP_MOCK_TIMER
+#error "MTSimulator.h needs MTLOOP_MOCK_TIMER"
+#endif
+
+namespace MT {
+
+    // ///////////////////////// //
+    //      TDurationModel       //
+    // ///////////////////////// //
+    // Распределение длительности задачи в тиках
+    class TDurationModel {
+        public:
+            using TRandom = std::mt19937_64;
+
+            static TDurationModel Fixed(tick_t duration);
+            static TDurationModel Uniform(tick_t min, tick_t max);
+            // Нормальное распределение, отсеченное снизу нулем
+            static TDurationModel Normal(double mean, double deviation);
+            // Равновероятный выбор из замеренных длительностей
+            static TDurationModel Empirical(std::vector<tick_t> samples);
+#if MTLOOP_STAT_HISTOGRAM
+            // Длительности, накопленные TStat на устройстве или в тестовом прогоне
+            static TDurationModel FromHistogram(const THistogram& histogram);
+            static TDurationModel FromStat(TStat& stat);
+#endif
+            tick_t Sample(TRandom& random) const;
+        private:
+            explicit TDurationModel(std::function<tick_t(TRandom&)> sample);
+
+            std::function<tick_t(TRandom&)> sample;
+    };
+
+    inline TDurationModel::TDurationModel(std::function<tick_t(TRandom&)> sample)
+        : sample(std::move(sample)) {
+    }
+    inline TDurationModel TDurationModel::Fixed(tick_t duration) {
+        return TDurationModel([duration](TRandom&) { return duration; });
+    }
+    inline TDurationModel TDurationModel::Uniform(tick_t min, tick_t max) {
+        std::uniform_int_distribution<tick_t> distribution(min, max);
+        return TDurationModel([distribution](TRandom& random) mutable { return distribution(random); });
+    }
+    inline TDurationModel TDurationModel::Normal(double mean, double deviation) {
+        std::normal_distribution<double> distribution(mean, deviation);
+        return TDurationModel([distribution](TRandom& random) mutable {
+            double value = distribution(random);
+            return value > 0 ? static_cast<tick_t>(value + 0.5) : tick_t(0);
+        });
+    }
+    inline TDurationModel TDurationModel::Empirical(std::vector<tick_t> samples) {
+        if (samples.empty())
+            samples.push_back(0);
+        std::uniform_int_distribution<size_t> index(0, samples.size() - 1);
+        return TDurationModel([samples, index](TRandom& random) mutable { return samples[index(random)]; });
+    }
+#if MTLOOP_STAT_HISTOGRAM
+    inline TDurationModel TDurationModel::FromHistogram(const THistogram& histogram) {
+        // Корзина выбирается по числу попаданий, значение - равномерно внутри
+        // корзины в пределах замеренных min и max
+        std::vector<size_t> buckets;
+        std::vector<double> weights;
+        for (size_t i = 0; i < THistogram::BUCKETS; ++i) {
+            if (histogram.GetBucketCount(i) == 0)
+                continue;
+            buckets.push_back(i);
+            weights.push_back(histogram.GetBucketCount(i));
+        }
+        if (buckets.empty())
+            return Fixed(0);
+        tick_t min = histogram.GetMin();
+        tick_t max = histogram.GetMax();
+        std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+        return TDurationModel([buckets, pick, min, max](TRandom& random) mutable {
+            size_t bucket = buckets[pick(random)];
+            tick_t low = THistogram::BucketLow(bucket) > min ? THistogram::BucketLow(bucket) : min;
+            tick_t high = THistogram::BucketHigh(bucket) < max ? THistogram::BucketHigh(bucket) : max;
+            return std::uniform_int_distribution<tick_t>(low, high)(random);
+        });
+    }
+    inline TDurationModel TDurationModel::FromStat(TStat& stat) {
+        return FromHistogram(stat.GetDurationHistogram());
+    }
+#endif
+    inline tick_t TDurationModel::Sample(TRandom& random) const {
+        return sample(random);
+    }
+
+
+    // ///////////////////////// //
+    //        TSimulator         //
+    // ///////////////////////// //
+    // Прогон расписания TLoop в модельном времени. Задачи симулируемых цепочек
+    // ничего не делают, а сдвигают мок-время на длительность из модели. Когда
+    // готовых цепочек нет, время сразу переводится на NextWakeTime(), поэтому
+    // часы расписания считаются за доли секунды. Время прохода переполнения
+    // tick_t не боится: прошедшее время копится в 64 битах.
+    struct TSimSlot {
+        TSimSlot(TDurationModel duration, tick_t minDuration, tick_t padding = DEFAULT_SLOT_PADDING, tick_t budget = 0)
+            : duration(std::move(duration))
+            , minDuration(minDuration)
+            , padding(padding)
+            , budget(budget) {
+        }
+        TDurationModel duration;
+        tick_t minDuration;
+        tick_t padding;
+        tick_t budget;
+    };
+
+    struct TSimChainReport {
+        std::string name;
+        uint64_t runs;
+        uint64_t busy;              // Тиков выполнения задач
+        double utilization;         // busy / elapsed
+        double meanLateness;        // Опоздание старта относительно начала тайм-слота
+        uint64_t maxLateness;
+        uint64_t missed;            // Окна номинальной сетки без выполнения, включая skips
+        uint64_t overruns;          // Выполнения дольше бюджета
+        uint64_t skips;             // Пропуски по OVERRUN_SKIP_NEXT
+    };
+
+    struct TSimReport {
+        uint64_t elapsed;
+        uint64_t busy;
+        double utilization;
+        uint64_t passes;            // Вызовов TLoop::Run()
+        std::vector<TSimChainReport> chains;
+    };
+
+    class TSimulator {
+        public:
+            explicit TSimulator(TLoop& loop, uint64_t seed = 1);
+            ~TSimulator();
+            TChainHandle AddChain(const std::string& name, std::initializer_list<TSimSlot> slots,
+                                  TOverrunPolicy policy = OVERRUN_STRETCH);
+            TTimeSlotChain& GetChain(size_t index);
+            // Продолжить симуляцию на duration тиков
+            const TSimReport& Run(uint64_t duration);
+            const TSimReport& GetReport();
+        private:
+            struct TSlotState {
+                TSimulator* simulator;
+                size_t chain;
+                TDurationModel duration;
+                tick_t minDuration;
+            };
+            struct TChainState {
+                std::unique_ptr<TTimeSlotChain> chain;
+                uint64_t lateness;          // Сумма опозданий для среднего
+                tick_t grid;                // Номинальное начало следующего выполнения
+            };
+            bool Execute(TSlotState& slot);
+
+            TLoop& loop;
+            TDurationModel::TRandom random;
+            std::vector<std::unique_ptr<TSlotState>> slots;
+            std::vector<TChainState> chains;
+            TSimReport report;
+    };
+
+    void WriteSimReport(std::ostream& out, const TSimReport& report);
+
+
+    inline TSimulator::TSimulator(TLoop& loop, uint64_t seed)
+        : loop(loop)
+        , random(seed)
+        , report() {
+    }
+    inline TSimulator::~TSimulator() {
+        for (TChainState& state : chains)
+            loop.Detach(*state.chain);
+    }
+    inline TChainHandle TSimulator::AddChain(const std::string& name, std::initializer_list<TSimSlot> simSlots, TOverrunPolicy policy) {
+        if (simSlots.size() == 0)
+            return INVALID_CHAIN;
+        size_t index = chains.size();
+        std::unique_ptr<TTimeSlotChain> chain;
+        for (const TSimSlot& simSlot : simSlots) {
+            slots.emplace_back(new TSlotState { this, index, simSlot.duration, simSlot.minDuration });
+            TSlotState* state = slots.back().get();
+            TTimeSlot slot({ [state](TLog&) { return state->simulator->Execute(*state); } },
+                           simSlot.minDuration, simSlot.padding, simSlot.budget);
+            if (!chain) {
+                // Первый тайм-слот начинается сейчас, а не в момент 1
+                slot.SetStartTime(TTimer::time);
+                chain.reset(new TTimeSlotChain { slot });
+            } else {
+                chain->Insert(chain->Size(), slot);
+            }
+        }
+        chain->SetOverrunPolicy(policy);
+        TChainHandle handle = loop.Attach(*chain);
+        if (handle == INVALID_CHAIN) {
+            slots.resize(slots.size() - simSlots.size());
+            return INVALID_CHAIN;
+        }
+        tick_t grid = chain->GetLTime();
+        chains.push_back(TChainState { std::move(chain), 0, grid });
+        TSimChainReport chainReport = TSimChainReport();
+        chainReport.name = name;
+        report.chains.push_back(chainReport);
+        return handle;
+    }
+    inline TTimeSlotChain& TSimulator::GetChain(size_t index) {
+        return *chains[index].chain;
+    }
+    inline bool TSimulator::Execute(TSlotState& slot) {
+        TChainState& chain = chains[slot.chain];
+        TSimChainReport& chainReport = report.chains[slot.chain];
+        tick_t start = TTimer::time;
+        tick_t planned = chain.chain->GetLTime();
+        uint64_t lateness = TimeAfter(start, planned) ? static_cast<tick_t>(start - planned) : 0;
+        tick_t duration = slot.duration.Sample(random);
+        TTimer::time = start + duration;
+        chainReport.runs++;
+        chainReport.busy += duration;
+        chain.lateness += lateness;
+        if (lateness > chainReport.maxLateness)
+            chainReport.maxLateness = lateness;
+        // Номинальная сетка - начало цепочки плюс minDuration выполненных
+        // тайм-слотов. Целые окна, на которые цепочка отстала, пропущены.
+        if (TimeAfter(start, chain.grid) && slot.minDuration > 0) {
+            tick_t behind = (start - chain.grid) / slot.minDuration;
+            chainReport.missed += behind;
+            chain.grid += behind * slot.minDuration;
+        }
+        chain.grid += slot.minDuration;
+        return true;
+    }
+    inline const TSimReport& TSimulator::Run(uint64_t duration) {
+        tick_t increment = TTimer::increment.exchange(0);
+        tick_t last = TTimer::time;
+        uint64_t elapsed = 0;
+        while (elapsed < duration) {
+            report.passes++;
+            if (!loop.Run()) {
+                // Простой: сразу к ближайшему сроку
+                tick_t now = TTimer::time;
+                tick_t wakeTime = loop.NextWakeTime();
+                uint64_t left = duration - elapsed;
+                if (!TimeAfter(wakeTime, now))
+                    wakeTime = now + 1;
+                else if (static_cast<tick_t>(wakeTime - now) > left)
+                    wakeTime = now + static_cast<tick_t>(left);
+                TTimer::time = wakeTime;
+            }
+            tick_t now = TTimer::time;
+            elapsed += static_cast<tick_t>(now - last);
+            last = now;
+        }
+        TTimer::increment = increment;
+        report.elapsed += elapsed;
+        return GetReport();
+    }
+    inline const TSimReport& TSimulator::GetReport() {
+        report.busy = 0;
+        for (size_t i = 0; i < chains.size(); ++i) {
+            TSimChainReport& chainReport = report.chains[i];
+            TTimeSlotChain& chain = *chains[i].chain;
+            chainReport.overruns = 0;
+            chainReport.skips = 0;
+            for (size_t s = 0; s < chain.Size(); ++s) {
+                chainReport.overruns += chain.At(s).GetStat().GetOverrunCount();
+                chainReport.skips += chain.At(s).GetStat().GetSkipCount();
+            }
+            chainReport.meanLateness = chainReport.runs > 0 ? static_cast<double>(chains[i].lateness) / chainReport.runs : 0;
+            chainReport.utilization = report.elapsed > 0 ? static_cast<double>(chainReport.busy) / report.elapsed : 0;
+            report.busy += chainReport.busy;
+        }
+        report.utilization = report.elapsed > 0 ? static_cast<double>(report.busy) / report.elapsed : 0;
+        return report;
+    }
+
+    inline void WriteSimReport(std::ostream& out, const TSimReport& report) {
+        out << "elapsed " << report.elapsed << " ticks, utilization " << report.utilization * 100
+            << "%, passes " << report.passes << "\n";
+        out << "chain,runs,utilization,mean_lateness,max_lateness,missed,overruns,skips\n";
+        for (const TSimChainReport& chain : report.chains)
+            out << chain.name << "," << chain.runs << "," << chain.utilization << "," << chain.meanLateness << ","
+                << chain.maxLateness << "," << chain.missed << "," << chain.overruns << "," << chain.skips << "\n";
+    }
+
+}
@@ -0,0 +1,135 @@
+/*
+ * MTTrace.h
+ * Разбор дампа TTraceBuffer и экспорт в формат Chrome trace-event (Perfetto)
+ */
+
+#pragma once
+
+#include "MTLoop.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace MT {
+
+    // ///////////////////////// //
+    //        TTraceRecord       //
+    // ///////////////////////// //
+    // Событие дампа в тиках устройства. Моменты развернуты через переполнение
+    // счетчика: соседние события отстоят меньше чем на половину диапазона тиков.
+    struct TTraceRecord {
+        uint16_t chain;
+        uint16_t slot;
+        bool result;
+        int64_t planned;
+        int64_t start;
+        int64_t stop;
+    };
+
+    struct TTraceDump {
+        uint8_t tickBytes;          // Разрядность tick_t устройства
+        uint32_t recorded;          // Записано всего, включая вытесненные
+        std::vector<TTraceRecord> records;
+    };
+
+    bool ReadTraceDump(const uint8_t* data, size_t size, TTraceDump& dump);
+    // Событие "X" на каждое выполнение: процесс - планировщик, поток - цепочка.
+    // usPerTick переводит тики в микросекунды шкалы трассы.
+    void WriteChromeTrace(std::ostream& out, const TTraceDump& dump, double usPerTick = 1.0);
+
+
+    inline uint64_t ReadLE(const uint8_t* data, size_t bytes) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            value |= static_cast<uint64_t>(data[i]) << (8 * i);
+        return value;
+    }
+    // Разность моментов a - b в тиках разрядности bits со знаком
+    inline int64_t TickDelta(uint64_t a, uint64_t b, size_t bits) {
+        uint64_t delta = a - b;
+        if (bits == 64)
+            return static_cast<int64_t>(delta);
+        uint64_t mask = (uint64_t(1) << bits) - 1;
+        delta &= mask;
+        if (delta & (uint64_t(1) << (bits - 1)))
+            return static_cast<int64_t>(delta) - static_cast<int64_t>(mask) - 1;
+        return static_cast<int64_t>(delta);
+    }
+
+    inline bool ReadTraceDump(const uint8_t* data, size_t size, TTraceDump& dump) {
+        const size_t HEADER_SIZE = 14;
+        if (size < HEADER_SIZE || data[0] != 'M' || data[1] != 'T' || data[2] != 'T' || data[3] != 'R')
+            return false;
+        if (data[4] != TRACE_DUMP_VERSION)
+            return false;
+        size_t tickBytes = data[5];
+        if (tickBytes != 2 && tickBytes != 4 && tickBytes != 8)
+            return false;
+        size_t count = static_cast<size_t>(ReadLE(data + 6, 4));
+        size_t eventSize = 5 + 3 * tickBytes;
+        if (size < HEADER_SIZE + count * eventSize)
+            return false;
+        dump.tickBytes = static_cast<uint8_t>(tickBytes);
+        dump.recorded = static_cast<uint32_t>(ReadLE(data + 10, 4));
+        dump.records.clear();
+        dump.records.reserve(count);
+        const uint8_t* p = data + HEADER_SIZE;
+        size_t bits = tickBytes * 8;
+        uint64_t prevStart = 0;
+        int64_t time = 0;
+        for (size_t i = 0; i < count; ++i, p += eventSize) {
+            TTraceRecord record;
+            record.chain = static_cast<uint16_t>(ReadLE(p, 2));
+            record.slot = static_cast<uint16_t>(ReadLE(p + 2, 2));
+            record.result = p[4] != 0;
+            uint64_t planned = ReadLE(p + 5, tickBytes);
+            uint64_t start = ReadLE(p + 5 + tickBytes, tickBytes);
+            uint64_t stop = ReadLE(p + 5 + 2 * tickBytes, tickBytes);
+            time = i == 0 ? static_cast<int64_t>(start) : time + TickDelta(start, prevStart, bits);
+            prevStart = start;
+            record.start = time;
+            record.planned = time + TickDelta(planned, start, bits);
+            record.stop = time + TickDelta(stop, start, bits);
+            dump.records.push_back(record);
+        }
+        return true;
+    }
+
+    inline std::string TraceThreadName(uint16_t chain) {
+        if (chain == TRACE_TIMER_CHAIN)
+            return "timers";
+        if (chain == TRACE_FD_CHAIN)
+            return "fd";
+        return "chain " + std::to_string(chain);
+    }
+
+    inline void WriteChromeTrace(std::ostream& out, const TTraceDump& dump, double usPerTick) {
+        out << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"recorded\":" << dump.recorded
+            << ",\"lost\":" << (dump.recorded > dump.records.size() ? dump.recorded - dump.records.size() : 0)
+            << "},\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"MTLoop\"}}";
+        std::vector<bool> named(0x10000, false);
+        for (const TTraceRecord& record : dump.records) {
+            if (named[record.chain])
+                continue;
+            named[record.chain] = true;
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << record.chain
+                << ",\"args\":{\"name\":\"" << TraceThreadName(record.chain) << "\"}}";
+        }
+        for (const TTraceRecord& record : dump.records) {
+            const char* slotName = record.chain == TRACE_FD_CHAIN ? "fd " : record.chain == TRACE_TIMER_CHAIN ? "timer " : "slot ";
+            out << ",\n{\"name\":\"" << slotName << record.slot << (record.result ? "" : " declined")
+                << "\",\"cat\":\"" << (record.result ? "slot" : "decline")
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << record.chain
+                << ",\"ts\":" << record.start * usPerTick
+                << ",\"dur\":" << (record.stop - record.start) * usPerTick
+                << ",\"args\":{\"planned\":" << record.planned
+                << ",\"start\":" << record.start
+                << ",\"stop\":" << record.stop
+                << ",\"lateness\":" << (record.start > record.planned ? record.start - record.planned : 0)
+                << ",\"result\":" << (record.result ? "true" : "false") << "}}";
+        }
+        out << "\n]}\n";
+    }
+
+}
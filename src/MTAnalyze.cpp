@@ -0,0 +1,98 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Отчет о выполнимости расписания по его описанию.
+//   MTLoop_analyze.exe [--cpu-scale K] [schedule.txt]
+// Без файла описание читается со стандартного ввода. Строки описания:
+//   policy deadline|round-robin|priority    - по умолчанию round-robin, как у TLoop
+//   chain <name> [priority]
+//   slot <minDuration> <padding> <wcet>     - тайм-слот последней цепочки
+// Пустые строки и строки с # пропускаются. Код возврата 1 - расписание невыполнимо.
+
+#include "MTAnalysis.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace MT;
+
+static bool ReadSchedule(std::istream& in, TScheduleModel& model) {
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword[0] == '#')
+            continue;
+        bool ok = true;
+        if (keyword == "policy") {
+            std::string policy;
+            words >> policy;
+            if (policy == "deadline")
+                model.SetPolicy(DISPATCH_DEADLINE);
+            else if (policy == "round-robin")
+                model.SetPolicy(DISPATCH_ROUND_ROBIN);
+            else if (policy == "priority")
+                model.SetPolicy(DISPATCH_PRIORITY);
+            else
+                ok = false;
+        } else if (keyword == "chain") {
+            std::string name;
+            unsigned priority = DEFAULT_CHAIN_PRIORITY;
+            ok = static_cast<bool>(words >> name);
+            if (ok && !(words >> priority))
+                priority = DEFAULT_CHAIN_PRIORITY;
+            ok = ok && priority <= 255;
+            if (ok)
+                model.AddChain(TChainModel { name, static_cast<uint8_t>(priority), {} });
+        } else if (keyword == "slot") {
+            unsigned long long minDuration, padding, wcet;
+            ok = model.GetChainCount() > 0 && static_cast<bool>(words >> minDuration >> padding >> wcet);
+            if (ok)
+                model.GetChain(model.GetChainCount() - 1).slots.push_back(TSlotBudget {
+                    static_cast<tick_t>(minDuration), static_cast<tick_t>(padding), static_cast<tick_t>(wcet) });
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "line " << number << ": cannot parse \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    double cpuScale = 1.0;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--cpu-scale") == 0 && i + 1 < argc) {
+            cpuScale = std::atof(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            std::cerr << "usage: " << argv[0] << " [--cpu-scale K] [schedule.txt]" << std::endl;
+            return 2;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    TScheduleModel model;
+    model.SetCpuScale(cpuScale);
+    bool ok;
+    if (path != nullptr) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "cannot open " << path << std::endl;
+            return 2;
+        }
+        ok = ReadSchedule(in, model);
+    } else {
+        ok = ReadSchedule(std::cin, model);
+    }
+    if (!ok)
+        return 2;
+    TScheduleAnalysis analysis = model.Analyze();
+    WriteScheduleReport(std::cout, analysis);
+    return analysis.feasible ? 0 : 1;
+}
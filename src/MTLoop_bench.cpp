@@ -0,0 +1,666 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Микробенчмарки планировщика.
+//   MTLoop_bench.exe        - мок-таймер, время двигает сам бенчмарк
+//   MTLoop_bench_rt.exe     - настоящий таймер Linux (MTLOOP_BENCH_REAL_TIMER)
+// Ключ --csv выводит строки bench,case,timer,value,unit для сравнения между версиями.
+
+#ifndef MTLOOP_BENCH_REAL_TIMER
+#define MTLOOP_MOCK_TIMER
+#endif
+#include "MTLoop.h"
+#include "MTParallelLoop.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace MT;
+
+    // Счетчик выделений памяти: Attach и Run не должны незаметно начать выделять память
+    static std::atomic<uint64_t> allocations(0);
+
+    // ///////////////////////// //
+    //         Вывод             //
+    // ///////////////////////// //
+    static bool csvOutput = false;
+#ifdef MTLOOP_BENCH_REAL_TIMER
+    static const char* TIMER_NAME = "monotonic";
+#else
+    static const char* TIMER_NAME = "mock";
+#endif
+
+    void Section(const char* bench, const std::string& title) {
+        if (!csvOutput)
+            std::printf("# %s: %s\n", bench, title.c_str());
+    }
+
+    void Report(const char* bench, const std::string& name, double value, const char* unit) {
+        if (csvOutput)
+            std::printf("%s,%s,%s,%.3f,%s\n", bench, name.c_str(), TIMER_NAME, value, unit);
+        else
+            std::printf("%-40s %14.3f %s\n", name.c_str(), value, unit);
+    }
+
+    std::string Param(const char* name, size_t value) {
+        return std::string(name) + "=" + std::to_string(value);
+    }
+
+    // С мок-таймером время двигает бенчмарк, настоящий таймер идет сам
+    inline void AdvanceTime(tick_t ticks) {
+#ifdef MTLOOP_MOCK_TIMER
+        TTimer::time.store(TTimer::time + ticks, std::memory_order_relaxed);
+#endif
+    }
+
+    inline void ResetTime() {
+#ifdef MTLOOP_MOCK_TIMER
+        TTimer::time = 1;
+        TTimer::increment = 0;
+#endif
+    }
+
+
+    // ///////////////////////// //
+    //     Опоздание старта      //
+    // ///////////////////////// //
+#ifdef MTLOOP_MOCK_TIMER
+    // Задача с периодом period тиков: измеряет опоздание старта относительно
+    // плановой границы тайм-слота
+    struct TLatencyTask: public IRunnable {
+        tick_t period;
+        tick_t planned = 1;
+        uint64_t runs = 0;
+        double sum = 0;
+        double sumSq = 0;
+        tick_t maxLateness = 0;
+
+        TLatencyTask(tick_t period): period(period) { }
+        virtual bool Run(TLog&) {
+            tick_t lateness = TTimer::time - planned;
+            planned += period;
+            // Первый запуск всех цепочек приходится на один тик - не учитываем
+            if (runs++ == 0)
+                return true;
+            sum += lateness;
+            sumSq += static_cast<double>(lateness) * lateness;
+            if (lateness > maxLateness)
+                maxLateness = lateness;
+            return true;
+        }
+    };
+
+    struct TJitter {
+        double mean;
+        double stddev;
+        tick_t max;
+    };
+
+    // Один проход планировщика стоит один тик таймера
+    TJitter MeasureJitter(TDispatchPolicy policy, size_t chains, tick_t ticks) {
+        ResetTime();
+        std::vector<TLatencyTask> tasks;
+        tasks.reserve(chains);
+        TLoop mtLoop {chains, defaultLog, policy};
+        for (size_t i = 0; i < chains; ++i) {
+            // Разные периоды, чтобы фазы цепочек расходились
+            tasks.emplace_back(128 + 7 * i);
+            mtLoop.Attach({ { tasks.back(), tasks.back().period, 0 } });
+        }
+        for (tick_t t = 0; t < ticks; ++t) {
+            mtLoop.Run();
+            TTimer::time++;
+        }
+
+        double sum = 0;
+        double sumSq = 0;
+        uint64_t runs = 0;
+        TJitter jitter = { 0, 0, 0 };
+        for (const auto& task : tasks) {
+            sum += task.sum;
+            sumSq += task.sumSq;
+            runs += task.runs - 1;
+            if (task.maxLateness > jitter.max)
+                jitter.max = task.maxLateness;
+        }
+        if (runs > 0) {
+            jitter.mean = sum / runs;
+            jitter.stddev = std::sqrt(sumSq / runs - jitter.mean * jitter.mean);
+        }
+        return jitter;
+    }
+
+    void BenchStartLatency() {
+        const tick_t ticks = 1000000;
+        Section("start_lateness", "start lateness vs chain count, 1 tick per TLoop::Run()");
+        for (size_t chains = 1; chains <= 64; chains *= 2) {
+            TJitter rr = MeasureJitter(DISPATCH_ROUND_ROBIN, chains, ticks);
+            TJitter edf = MeasureJitter(DISPATCH_DEADLINE, chains, ticks);
+            std::string param = Param("chains", chains);
+            Report("start_lateness", "rr/" + param + "/mean", rr.mean, "ticks");
+            Report("start_lateness", "rr/" + param + "/stddev", rr.stddev, "ticks");
+            Report("start_lateness", "rr/" + param + "/max", rr.max, "ticks");
+            Report("start_lateness", "edf/" + param + "/mean", edf.mean, "ticks");
+            Report("start_lateness", "edf/" + param + "/stddev", edf.stddev, "ticks");
+            Report("start_lateness", "edf/" + param + "/max", edf.max, "ticks");
+        }
+    }
+#endif
+
+
+    // ///////////////////////// //
+    //      Стоимость Run()      //
+    // ///////////////////////// //
+    static uint32_t counter = 0;
+    struct TCounterTask: public IRunnable {
+        virtual bool Run(TLog&) {
+            counter++;
+            return true;
+        }
+    } counterTask;
+
+    bool CounterCallback(TLog&) {
+        counter++;
+        return true;
+    }
+
+    struct TRunCost {
+        double ns;
+        double allocations;     // Выделений памяти на один Run()
+    };
+
+    // Все цепочки всегда просрочены: тайм-слоты длиной в тик, время идет на 2 тика за проход
+    TRunCost MeasureRun(TLoop& mtLoop, size_t iterations) {
+        uint64_t allocated = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            AdvanceTime(2);
+            mtLoop.Run();
+        }
+        auto stop = std::chrono::steady_clock::now();
+        TRunCost cost;
+        cost.ns = std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+        cost.allocations = static_cast<double>(allocations.load() - allocated) / iterations;
+        return cost;
+    }
+
+    TRunCost MeasureSlot(const TTimeSlot& slot, size_t iterations) {
+        ResetTime();
+        TLoop mtLoop {1};
+        mtLoop.Attach({ slot });
+        return MeasureRun(mtLoop, iterations);
+    }
+
+    // Стоимость одного TLoop::Run(), в котором выполняется пустая задача
+    void BenchRunOverhead() {
+        const size_t iterations = 10000000;
+        Section("run_adapter", "ns per TLoop::Run() executing one task, by task type");
+        Report("run_adapter", "callback", MeasureSlot({ CounterCallback, 1, 0 }, iterations).ns, "ns");
+        Report("run_adapter", "lambda", MeasureSlot({ { [](TLog&){ counter++; return true; } }, 1, 0 }, iterations).ns, "ns");
+        Report("run_adapter", "void_lambda", MeasureSlot({ { [](){ counter++; } }, 1, 0 }, iterations).ns, "ns");
+        Report("run_adapter", "irunnable", MeasureSlot({ counterTask, 1, 0 }, iterations).ns, "ns");
+        // Захват больше MTLOOP_CALLABLE_WORDS слов - задача лежит в куче
+        char big[64] = { 0 };
+        TRunCost heap = MeasureSlot({ { [big](TLog&){ counter += big[0] + 1; return true; } }, 1, 0 }, iterations);
+        Report("run_adapter", "heap_lambda", heap.ns, "ns");
+        Report("run_adapter", "heap_lambda/allocs", heap.allocations, "allocs/run");
+    }
+
+    // ///////////////////////// //
+    //       Логирование         //
+    // ///////////////////////// //
+    // Приемник, который, как обычный лог на хосте, копирует строку
+    struct TStringLog: public TLog {
+        std::string last;
+        size_t lines = 0;
+        void Log(const char* logLine) override {
+            last = logLine;
+            ++lines;
+        }
+    };
+
+    // Run() с отложенным логом: кольцо выводится между пачками вне замера
+    double MeasureDeferred(TLoop& mtLoop, TDeferredLog& deferred, TStringLog& sink, size_t iterations) {
+        const size_t batch = TDeferredLog::SIZE / 2;
+        std::chrono::steady_clock::duration total {};
+        for (size_t done = 0; done < iterations; done += batch) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < batch; ++i) {
+                AdvanceTime(2);
+                mtLoop.Run();
+            }
+            total += std::chrono::steady_clock::now() - start;
+            deferred.Flush(sink);
+        }
+        return std::chrono::duration<double, std::nano>(total).count() / iterations;
+    }
+
+    // Стоимость строки лога внутри задачи: до - виртуальный TLog::Log с
+    // форматированием в задаче, после - уровни и отложенный лог
+    void BenchLogCost() {
+        const size_t iterations = 4000000;
+        Section("log_cost", "ns per TLoop::Run() executing one task that logs a line");
+        Report("log_cost", "no_log", MeasureSlot({ CounterCallback, 1, 0 }, iterations).ns, "ns");
+        {
+            ResetTime();
+            TLoop mtLoop {1};
+            mtLoop.Attach({ { { [](TLog& log){ counter++; log.Log("tick"); return true; } }, 1, 0 } });
+            Report("log_cost", "tlog_empty", MeasureRun(mtLoop, iterations).ns, "ns");
+        }
+        {
+            ResetTime();
+            TStringLog sink;
+            TLoop mtLoop {1, sink};
+            mtLoop.Attach({ { { [](TLog& log){ log.Log("tick"); return true; } }, 1, 0 } });
+            Report("log_cost", "tlog_string", MeasureRun(mtLoop, iterations).ns, "ns");
+        }
+        {
+            ResetTime();
+            TStringLog sink;
+            TLoop mtLoop {1, sink};
+            mtLoop.Attach({ { { [](TLog& log){
+                char line[64];
+                std::snprintf(line, sizeof(line), "tick %u of %s", static_cast<unsigned>(counter++), "chain");
+                log.Log(line);
+                return true;
+            } }, 1, 0 } });
+            Report("log_cost", "tlog_snprintf", MeasureRun(mtLoop, iterations).ns, "ns");
+        }
+        {
+            ResetTime();
+            TStringLog sink;
+            TLoop mtLoop {1, sink};
+            mtLoop.Attach({ { { [](TLog& log){ counter++; log.Write<LOG_DEBUG>("tick"); return true; } }, 1, 0 } });
+            Report("log_cost", "level_compiled_out", MeasureRun(mtLoop, iterations).ns, "ns");
+        }
+        {
+            ResetTime();
+            TStringLog sink;
+            TDeferredLog deferred;
+            TLoop mtLoop {1, deferred};
+            mtLoop.Attach({ { { [&deferred](TLog&){
+                deferred.Write("tick %u of %s", static_cast<unsigned>(counter++), "chain");
+                return true;
+            } }, 1, 0 } });
+            Report("log_cost", "deferred", MeasureDeferred(mtLoop, deferred, sink, iterations), "ns");
+            // Форматирование вне горячего пути на строку
+            for (size_t i = 0; i < TDeferredLog::SIZE; ++i)
+                deferred.Write("tick %u of %s", static_cast<unsigned>(i), "chain");
+            auto start = std::chrono::steady_clock::now();
+            size_t lines = deferred.Flush(sink);
+            auto stop = std::chrono::steady_clock::now();
+            Report("log_cost", "deferred_flush", std::chrono::duration<double, std::nano>(stop - start).count() / lines, "ns/line");
+            Report("log_cost", "deferred/dropped", deferred.GetDropped(), "lines");
+        }
+    }
+
+    // Стоимость Run() в зависимости от числа цепочек и длины цепочки
+    void BenchRunScaling() {
+        const size_t iterations = 2000000;
+        Section("run_scaling", "ns per TLoop::Run() vs chain count and slots per chain");
+        for (TDispatchPolicy policy : { DISPATCH_DEADLINE, DISPATCH_ROUND_ROBIN, DISPATCH_PRIORITY }) {
+            const char* policyName = policy == DISPATCH_DEADLINE ? "edf" : policy == DISPATCH_PRIORITY ? "prio" : "rr";
+            for (size_t chains = 1; chains <= 512; chains *= 8) {
+                for (size_t slots = 1; slots <= 16; slots *= 4) {
+                    ResetTime();
+                    std::vector<std::unique_ptr<TTimeSlotChain>> owned;
+                    TLoop mtLoop {chains, defaultLog, policy};
+                    for (size_t c = 0; c < chains; ++c) {
+                        owned.emplace_back(new TTimeSlotChain { { CounterCallback, 1, 0 } });
+                        for (size_t s = 1; s < slots; ++s)
+                            owned.back()->Insert(s, { CounterCallback, 1, 0 });
+                        mtLoop.Attach(*owned.back());
+                    }
+                    TRunCost cost = MeasureRun(mtLoop, iterations);
+                    std::string name = std::string(policyName) + "/" + Param("chains", chains) + "/" + Param("slots", slots);
+                    Report("run_scaling", name, cost.ns, "ns");
+                    Report("run_scaling", name + "/allocs", cost.allocations, "allocs/run");
+                }
+            }
+        }
+    }
+
+    // Пропускная способность, когда готовы сразу все цепочки. Как в скетче
+    // Arduino, планировщик вызывается из loop(), которую main() вызывает в
+    // цикле: по одной задаче на loop() через Run() или все готовые через
+    // RunBatch(). Время сдвигается, когда loop() ничего не выполнила.
+    // Варианты /yield добавляют к каждому возврату из loop() отдачу процессора,
+    // как ядро ESP8266 (обслуживание сети) или цикл событий на хосте.
+    static TLoop* sketchLoop = nullptr;
+    static bool (*volatile sketchLoopFn)() = nullptr;
+
+    bool LoopRun() {
+        return sketchLoop->Run();
+    }
+    bool LoopRunBatch() {
+        sketchLoop->RunBatch();
+        return false;
+    }
+
+    double MeasureThroughput(size_t chains, size_t tasks, bool (*loopFn)(), bool yield) {
+        ResetTime();
+        std::vector<std::unique_ptr<TTimeSlotChain>> owned;
+        TLoop mtLoop {chains};
+        for (size_t c = 0; c < chains; ++c) {
+            owned.emplace_back(new TTimeSlotChain { { CounterCallback, 1, 0 } });
+            mtLoop.Attach(*owned.back());
+        }
+        sketchLoop = &mtLoop;
+        sketchLoopFn = loopFn;
+        uint32_t first = counter;
+        auto start = std::chrono::steady_clock::now();
+        while (counter - first < tasks) {
+            if (!sketchLoopFn())
+                AdvanceTime(1);
+            if (yield)
+                std::this_thread::yield();
+        }
+        auto stop = std::chrono::steady_clock::now();
+        sketchLoop = nullptr;
+        return (counter - first) / std::chrono::duration<double>(stop - start).count();
+    }
+
+    void BenchBatch() {
+        const size_t tasks = 2000000;
+        Section("batch", "tasks per second with every chain due, one Run() or RunBatch() per loop()");
+        for (size_t chains = 8; chains <= 512; chains *= 8) {
+            std::string param = Param("chains", chains);
+            Report("batch", "run/" + param, MeasureThroughput(chains, tasks, LoopRun, false) / 1e6, "Mtasks/s");
+            Report("batch", "run_batch/" + param, MeasureThroughput(chains, tasks, LoopRunBatch, false) / 1e6, "Mtasks/s");
+            Report("batch", "run/yield/" + param, MeasureThroughput(chains, tasks, LoopRun, true) / 1e6, "Mtasks/s");
+            Report("batch", "run_batch/yield/" + param, MeasureThroughput(chains, tasks, LoopRunBatch, true) / 1e6, "Mtasks/s");
+        }
+    }
+
+    // ///////////////////////// //
+    //     Раскладка цепочки     //
+    // ///////////////////////// //
+    // Промахи последнего уровня кэша за замер. Без аппаратных счетчиков
+    // (виртуальная машина, контейнер, perf_event_paranoid) Start() вернет false.
+    class TCacheMisses {
+        public:
+            ~TCacheMisses() {
+#ifdef __linux__
+                if (fd >= 0)
+                    close(fd);
+#endif
+            }
+            bool Start() {
+#ifdef __linux__
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fd < 0)
+                    return false;
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+                return true;
+#else
+                return false;
+#endif
+            }
+            uint64_t Stop() {
+                uint64_t misses = 0;
+#ifdef __linux__
+                if (fd >= 0) {
+                    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+                        misses = 0;
+                }
+#endif
+                return misses;
+            }
+        private:
+            int fd = -1;
+    };
+
+    // Тысячи цепочек по slots тайм-слотов, все всегда просрочены: каждый Run()
+    // выполняет задачу другой цепочки, данные которой давно вытеснены из кэша.
+    // TTimeSlotChain хранит TTimeSlot целиком со статистикой, TPackedChain -
+    // только нужные проходу поля в параллельных массивах.
+    template<typename TChain>
+    void ReportLayout(const char* layout, size_t chains, size_t slots, size_t bytesPerChain) {
+        const size_t iterations = 2000000;
+        ResetTime();
+        std::vector<std::unique_ptr<TChain>> owned;
+        TLoop mtLoop {chains};
+        for (size_t c = 0; c < chains; ++c) {
+            owned.emplace_back(new TChain { { CounterCallback, 1, 0 }, { CounterCallback, 1, 0 },
+                                            { CounterCallback, 1, 0 }, { CounterCallback, 1, 0 } });
+            mtLoop.Attach(*owned.back());
+        }
+        // Один круг вне замера, чтобы не считать первые обращения к памяти
+        MeasureRun(mtLoop, chains * slots);
+        TCacheMisses misses;
+        bool counted = misses.Start();
+        TRunCost cost = MeasureRun(mtLoop, iterations);
+        uint64_t missCount = misses.Stop();
+        std::string name = std::string(layout) + "/" + Param("chains", chains);
+        Report("chain_layout", name, cost.ns, "ns");
+        if (counted)
+            Report("chain_layout", name + "/cache_misses", static_cast<double>(missCount) / iterations, "misses/run");
+        Report("chain_layout", name + "/bytes", bytesPerChain, "bytes/chain");
+    }
+
+    void BenchChainLayout() {
+        const size_t slots = 4;
+        const size_t timeSlotBytes = sizeof(TTimeSlotChain) + slots * sizeof(TTimeSlot);
+        const size_t packedBytes = sizeof(TPackedChain) + slots * (sizeof(TCallable) + 5 * sizeof(tick_t) + 2 * sizeof(uint32_t));
+        Section("chain_layout", "ns per TLoop::Run() with thousands of 4-slot chains, by slot layout");
+        for (size_t chains = 1024; chains <= 16384; chains *= 4) {
+            ReportLayout<TTimeSlotChain>("time_slot_chain", chains, slots, timeSlotBytes);
+            ReportLayout<TPackedChain>("packed_chain", chains, slots, packedBytes);
+        }
+    }
+
+    // Выделения памяти при подключении цепочки
+    template<typename TAttach>
+    void ReportAttach(const std::string& name, TAttach attach) {
+        uint64_t allocated = allocations.load();
+        attach();
+        Report("attach_alloc", name, allocations.load() - allocated, "allocs");
+    }
+
+    void BenchAttachAllocations() {
+        Section("attach_alloc", "heap allocations per Attach()");
+        TTimeSlot a {CounterCallback, 1, 0};
+        TLoop loop {4};
+        ReportAttach("tloop/slots=1", [&]{ loop.Attach({ a }); });
+        ReportAttach("tloop/slots=4", [&]{ loop.Attach({ a, a, a, a }); });
+        ReportAttach("tloop/slots=8", [&]{ loop.Attach({ a, a, a, a, a, a, a, a }); });
+        TFixedLoop<4, 8> fixedLoop;
+        ReportAttach("tfixedloop/slots=1", [&]{ fixedLoop.Attach({ a }); });
+        ReportAttach("tfixedloop/slots=4", [&]{ fixedLoop.Attach({ a, a, a, a }); });
+        ReportAttach("tfixedloop/slots=8", [&]{ fixedLoop.Attach({ a, a, a, a, a, a, a, a }); });
+        // Большой захват не помещается в TCallable
+        char big[64] = { 0 };
+        ReportAttach("tfixedloop/heap_lambda", [&]{ fixedLoop.Attach({ { { [big](TLog&){ return big[0] == 0; } }, 1, 0 } }); });
+    }
+
+
+    // ///////////////////////// //
+    //      Разовые задачи       //
+    // ///////////////////////// //
+    // Стоимость операций с разовыми задачами при большом числе ожидающих таймеров
+    void BenchTimers() {
+        const size_t count = 50000;
+        std::mt19937 rnd(1);
+        std::vector<tick_t> delays(count);
+        for (auto& delay : delays)
+            delay = 1 + rnd() % 10000000;
+        std::vector<TTimerHandle> handles(count);
+
+        ResetTime();
+        TLoop mtLoop {1};
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            handles[i] = mtLoop.PostAfter(delays[i], { [](TLog&){ counter++; return true; } });
+        auto posted = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i += 2)
+            mtLoop.Cancel(handles[i]);
+        auto cancelled = std::chrono::steady_clock::now();
+        size_t done = 0;
+        while (done < count / 2) {
+            TTimer::SleepUntil(mtLoop.NextWakeTime());
+            done += mtLoop.RunUntilIdle();
+        }
+        auto expired = std::chrono::steady_clock::now();
+
+        Section("timers", "one-shot timers, " + Param("pending", count));
+        Report("timers", "post_after",
+            std::chrono::duration<double, std::nano>(posted - start).count() / count, "ns");
+        Report("timers", "cancel",
+            std::chrono::duration<double, std::nano>(cancelled - posted).count() / (count / 2), "ns");
+        Report("timers", "expire",
+            std::chrono::duration<double, std::nano>(expired - cancelled).count() / done, "ns");
+    }
+
+
+    // ///////////////////////// //
+    //      Чтение времени       //
+    // ///////////////////////// //
+    // Стоимость чтения времени разными таймерами: TLoop::Run() читает время
+    // дважды за проход
+    template<typename TRead>
+    double MeasureRead(TRead read, size_t iterations) {
+        uint64_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+            sum += read();
+        auto stop = std::chrono::steady_clock::now();
+        counter += static_cast<uint32_t>(sum);
+        return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+    }
+
+    void BenchTimerRead() {
+        const size_t iterations = 10000000;
+        Section("timer_read", "ns per GetTime()");
+        Report("timer_read", "ttimer", MeasureRead([]{ return TTimer::GetTime(); }, iterations), "ns");
+        Report("timer_read", "clock_monotonic", MeasureRead([]{ return TMonotonicTimer::GetTime(); }, iterations), "ns");
+        Report("timer_read", "clock_monotonic_raw", MeasureRead([]{ return TMonotonicRawTimer::GetTime(); }, iterations), "ns");
+#ifdef __x86_64__
+        Report("timer_read", "rdtsc", MeasureRead([]{ return TTscTimer::GetTime(); }, iterations), "ns");
+        Report("timer_read", "tsc_frequency", TTscTimer::GetFrequency(), "Hz");
+#endif
+    }
+
+
+    // ///////////////////////// //
+    //       TParallelLoop       //
+    // ///////////////////////// //
+    // Пропускная способность TParallelLoop в зависимости от числа рабочих потоков.
+    // Задачи загружают процессор на несколько микросекунд, мок-время идет
+    // медленнее, чем потоки успевают пройти все цепочки, - все цепочки всегда готовы.
+    struct TSpinChainCounter {
+        uint64_t runs = 0;
+        char pad[56];   // Счетчики разных цепочек - в разных кэш-линиях
+    };
+
+    bool SpinTask(TSpinChainCounter* counter) {
+        volatile uint32_t x = 0;
+        for (uint32_t i = 0; i < 2000; ++i)
+            x = x + i;
+        counter->runs++;
+        return true;
+    }
+
+    void BenchParallel() {
+        const size_t chains = 256;
+        const auto duration = std::chrono::milliseconds(300);
+        size_t maxWorkers = std::thread::hardware_concurrency();
+        if (maxWorkers < 4)
+            maxWorkers = 4;
+        Section("parallel", "TParallelLoop, " + Param("chains", chains) + ", "
+            + Param("hardware_threads", std::thread::hardware_concurrency()));
+        double base = 0;
+        for (size_t workers = 1; workers <= maxWorkers; workers *= 2) {
+            ResetTime();
+            std::vector<TSpinChainCounter> counters(chains);
+            TParallelLoop mtLoop {workers, chains};
+            for (auto& counter : counters) {
+                TSpinChainCounter* p = &counter;
+                mtLoop.Attach({
+                    { { [p](TLog&){ return SpinTask(p); } }, 1, 0 },
+                    { { [p](TLog&){ return SpinTask(p); } }, 1, 0 }
+                });
+            }
+            auto start = std::chrono::steady_clock::now();
+            mtLoop.Start();
+            while (std::chrono::steady_clock::now() - start < duration) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                AdvanceTime(1);
+            }
+            mtLoop.Stop();
+            auto stop = std::chrono::steady_clock::now();
+
+            uint64_t runs = 0;
+            for (const auto& counter : counters)
+                runs += counter.runs;
+            double rate = runs / std::chrono::duration<double>(stop - start).count();
+            if (base == 0)
+                base = rate;
+            std::string param = Param("workers", workers);
+            Report("parallel", param + "/tasks_per_s", rate, "1/s");
+            Report("parallel", param + "/speedup", rate / base, "x");
+            Report("parallel", param + "/steals", mtLoop.GetStealCount(), "count");
+        }
+    }
+
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size > 0 ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+int main (int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], "--csv") == 0)
+            csvOutput = true;
+    if (csvOutput)
+        std::printf("bench,case,timer,value,unit\n");
+
+#ifdef MTLOOP_MOCK_TIMER
+    BenchStartLatency();
+#endif
+    BenchRunOverhead();
+    BenchLogCost();
+    BenchRunScaling();
+    BenchBatch();
+    BenchChainLayout();
+    BenchAttachAllocations();
+    BenchTimers();
+    BenchTimerRead();
+    BenchParallel();
+    return 0;
+}
@@ -5,15 +5,50 @@
 
 #define DEBUG
 #define MTLOOP_MOCK_TIMER
+#define MTLOOP_TRACE 1
+#define MTLOOP_STAT_HISTOGRAM 1
 //#include <boost/test/unit_test.hpp>
 #include <boost/test/included/unit_test.hpp>
 #include "MTLoop.h"
+#include "MTParallelLoop.h"
+#include "MTEpollLoop.h"
+#include "MTTrace.h"
+#include "MTLogThread.h"
+#include "MTSimulator.h"
+#include "MTAnalysis.h"
+#if MTLOOP_COROUTINES
+#include "MTCoroutine.h"
+#endif
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <string>
+#include <sstream>
 #include <memory>
 #include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
 
 using namespace MT;
 
+// Подсчет обращений к куче
+static size_t allocCount = 0;
+
+void* operator new(size_t size) {
+    allocCount++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
 BOOST_AUTO_TEST_SUITE(testSuiteMTLoop)
 
     struct TMockLog: public TLog {
@@ -407,6 +442,2033 @@ BOOST_AUTO_TEST_SUITE(testSuiteMTLoop)
     }
 
 
+    // Цепочка, тайм-слот которой еще не наступил, не занимает проход планировщика
+    BOOST_FIXTURE_TEST_CASE( testTLoopDeadline01, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log, DISPATCH_DEADLINE};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"A1 IS RUN"); return true; } }, 100, 0 },
+                { { [](TLog& log){ log.Log((char*)"A2 IS RUN"); return true; } }, 100, 0 }
+            });
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"B1 IS RUN"); return true; } }, 10, 0 },
+                { { [](TLog& log){ log.Log((char*)"B2 IS RUN"); return true; } }, 10, 0 }
+            });
+
+            TTimer::time = 50;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+            BOOST_CHECK_EQUAL(log.logLines[0], "A1 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[1], "B1 IS RUN");
+
+            // Ни одна цепочка не готова
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+
+            // Цепочка A не готова, сразу запускается B
+            TTimer::time = 51;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 3);
+            BOOST_CHECK_EQUAL(log.logLines[2], "B2 IS RUN");
+        }
+    }
+
+
+    // Режим round-robin сохраняет прежнее поведение
+    BOOST_FIXTURE_TEST_CASE( testTLoopRoundRobin01, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log, DISPATCH_ROUND_ROBIN};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"A1 IS RUN"); return true; } }, 100, 0 },
+                { { [](TLog& log){ log.Log((char*)"A2 IS RUN"); return true; } }, 100, 0 }
+            });
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"B1 IS RUN"); return true; } }, 10, 0 },
+                { { [](TLog& log){ log.Log((char*)"B2 IS RUN"); return true; } }, 10, 0 }
+            });
+
+            TTimer::time = 50;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+
+            TTimer::time = 51;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 3);
+            BOOST_CHECK_EQUAL(log.logLines[2], "B2 IS RUN");
+        }
+    }
+
+
+    // Задача, вернувшая false, не блокирует остальные просроченные цепочки
+    BOOST_FIXTURE_TEST_CASE( testTLoopDeadline02, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"BUSY"); return false; } }, 100, 0 }
+            });
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"B1 IS RUN"); return true; } }, 100, 0 }
+            });
+
+            TTimer::time = 50;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+            BOOST_CHECK_EQUAL(log.logLines[0], "BUSY");
+            BOOST_CHECK_EQUAL(log.logLines[1], "B1 IS RUN");
+        }
+    }
+
+
+    // Две кучи в общей памяти: обычная по сроку и куча готовых по приоритету
+    BOOST_AUTO_TEST_CASE( testTChainHeapPriority ) {
+        TChainHeap::TEntry entries[5];
+        TChainHeap byDeadline(entries);
+        TReadyChainHeap byPriority(entries, 5);
+        byDeadline.Push(0, 30, 0);
+        byDeadline.Push(1, 10, 0);
+        byPriority.Push(2, 50, 1);
+        byPriority.Push(3, 20, 1);
+        byPriority.Push(4, 5, 0);
+        BOOST_CHECK_EQUAL(byDeadline.Top(), 1);
+        BOOST_CHECK_EQUAL(byPriority.Top(), 3);
+        byPriority.Remove(3);
+        BOOST_CHECK_EQUAL(byPriority.Top(), 2);
+        byPriority.SetPriority(4, 2);
+        BOOST_CHECK_EQUAL(byPriority.Top(), 4);
+        BOOST_CHECK_EQUAL(byPriority.GetPriority(4), 2);
+        byDeadline.Push(3, 0);
+        BOOST_CHECK_EQUAL(byDeadline.Top(), 3);
+        BOOST_CHECK_EQUAL(byDeadline.GetPriority(3), 1);
+        BOOST_CHECK_EQUAL(byDeadline.Size(), 3);
+        BOOST_CHECK_EQUAL(byPriority.Size(), 2);
+    }
+
+
+    // Готовая цепочка старшего класса обгоняет более просроченные младшие;
+    // отказавшая цепочка старшего класса пропускает младшие до следующего тика
+    BOOST_FIXTURE_TEST_CASE( testTLoopPriority01, TTimeSlotFixture ) {
+        TLoop mtLoop {10, log, DISPATCH_PRIORITY};
+        mtLoop.Attach({
+            { { [](TLog& log){ log.Log((char*)"LOW IS RUN"); return true; } }, 100, 0 }
+        });
+        TChainHandle high = mtLoop.Attach({
+            { { [](TLog& log){ log.Log((char*)"HIGH IS RUN"); return true; } }, 100, 0 },
+            { { [](TLog& log){ log.Log((char*)"HIGH IS BUSY"); return false; } }, 100, 0 }
+        });
+        BOOST_CHECK(mtLoop.SetPriority(high, 3));
+        BOOST_CHECK_EQUAL(mtLoop.GetPriority(high), 3);
+        BOOST_CHECK(!mtLoop.SetPriority(INVALID_CHAIN, 1));
+
+        TTimer::time = 50;
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        TTimer::time = 101;
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+        TTimer::time = 102;
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+        BOOST_CHECK_EQUAL(log.logLines.size(), 5);
+        BOOST_CHECK_EQUAL(log.logLines[0], "HIGH IS RUN");
+        BOOST_CHECK_EQUAL(log.logLines[1], "LOW IS RUN");
+        BOOST_CHECK_EQUAL(log.logLines[2], "HIGH IS BUSY");
+        BOOST_CHECK_EQUAL(log.logLines[3], "LOW IS RUN");
+        BOOST_CHECK_EQUAL(log.logLines[4], "HIGH IS BUSY");
+
+        // Смена политики возвращает готовые цепочки в общую кучу
+        mtLoop.SetDispatchPolicy(DISPATCH_DEADLINE);
+        BOOST_CHECK(mtLoop.Detach(high));
+        BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 201);
+    }
+
+
+    // Перегрузка младшими цепочками: 8 цепочек по 20 тиков с периодом 50.
+    // Старшая цепочка с периодом 100 опаздывает не больше чем на одну младшую
+    // задачу, а без приоритета ждет, пока пройдет очередь просроченных младших.
+    tick_t PriorityLateness(TDispatchPolicy policy) {
+        TMockLog log;
+        TTimer::time = 1;
+        TLoop mtLoop {10, log, policy};
+        TTimeSlot highSlot({ [](TLog&){ TTimer::time += 1; return true; } }, 100, 0);
+        TTimeSlotChain highChain({ highSlot });
+        for (int i = 0; i < 8; ++i)
+            mtLoop.Attach({ { { [](TLog&){ TTimer::time += 20; return true; } }, 50, 0 } });
+        TChainHandle high = mtLoop.Attach(highChain);
+        mtLoop.SetPriority(high, 1);
+        // RunUntilIdle под перегрузкой не возвращается - проходы по одному
+        for (int i = 0; i < 2000; ++i)
+            if (!mtLoop.Run())
+                TTimer::SleepUntil(mtLoop.NextWakeTime());
+        return highChain.At(0).GetStat().GetLatenessHistogram().GetMax();
+    }
+
+    BOOST_AUTO_TEST_CASE( testTLoopPriority02 ) {
+        tick_t priorityLateness = PriorityLateness(DISPATCH_PRIORITY);
+        tick_t deadlineLateness = PriorityLateness(DISPATCH_DEADLINE);
+        BOOST_CHECK(priorityLateness <= 20);
+        BOOST_CHECK(deadlineLateness >= 5 * 20);
+        BOOST_TEST_MESSAGE("high priority lateness " << priorityLateness << " vs " << deadlineLateness);
+    }
+
+
+    // Время ближайшего пробуждения - самое раннее начало текущих тайм-слотов
+    BOOST_FIXTURE_TEST_CASE( testTLoopNextWakeTime, TTimeSlotFixture ) {
+        for (TDispatchPolicy policy : { DISPATCH_DEADLINE, DISPATCH_ROUND_ROBIN, DISPATCH_PRIORITY }) {
+            TLoop mtLoop {10, log, policy};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"A1 IS RUN"); return true; } }, 100, 0 },
+                { { [](TLog& log){ log.Log((char*)"A2 IS RUN"); return true; } }, 100, 0 }
+            });
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"B1 IS RUN"); return true; } }, 30, 0 },
+                { { [](TLog& log){ log.Log((char*)"B2 IS RUN"); return true; } }, 30, 0 }
+            });
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 1);
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 2);
+            BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 31);
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 0);
+        }
+    }
+
+
+    // WaitAndRun засыпает до ближайшего тайм-слота и выполняет все готовые задачи
+    BOOST_FIXTURE_TEST_CASE( testTLoopWaitAndRun, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"A1 IS RUN"); return true; } }, 100, 0 },
+                { { [](TLog& log){ log.Log((char*)"A2 IS RUN"); return true; } }, 100, 0 }
+            });
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"B1 IS RUN"); return true; } }, 100, 0 },
+                { { [](TLog& log){ log.Log((char*)"B2 IS RUN"); return true; } }, 100, 0 }
+            });
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(TTimer::SleepUntil), 2);
+            BOOST_CHECK_EQUAL(TTimer::time, 10);
+            BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(TTimer::SleepUntil), 2);
+            BOOST_CHECK_EQUAL(TTimer::time, 101);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 4);
+            BOOST_CHECK_EQUAL(log.logLines[2], "A2 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[3], "B2 IS RUN");
+        }
+    }
+
+
+    // Задача, которая никогда не выполняется, не зацикливает RunUntilIdle
+    BOOST_FIXTURE_TEST_CASE( testTLoopRunUntilIdleBusy, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log, DISPATCH_DEADLINE};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"BUSY"); return false; } }, 100, 0 }
+            });
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 0);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 1);
+            BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 10);
+        }
+    }
+
+
+    // RunBatch выполняет все готовые тайм-слоты за один вызов: в порядке сроков,
+    // а в режиме DISPATCH_ROUND_ROBIN - по кругу в порядке номеров цепочек
+    BOOST_FIXTURE_TEST_CASE( testTLoopRunBatch, TTimeSlotFixture ) {
+        for (TDispatchPolicy policy : { DISPATCH_DEADLINE, DISPATCH_ROUND_ROBIN, DISPATCH_PRIORITY }) {
+            TMockLog batchLog;
+            TLoop mtLoop {10, batchLog, policy};
+            std::vector<std::unique_ptr<TTimeSlotChain>> owned;
+            const char* names[] = { "C", "A", "D", "B" };
+            const tick_t starts[] = { 7, 3, 9, 5 };
+            for (size_t i = 0; i < 4; ++i) {
+                const char* name = names[i];
+                TTimeSlot slot({ [name](TLog& log){ log.Log(name); return true; } }, 50, 0);
+                slot.SetStartTime(starts[i]);
+                owned.emplace_back(new TTimeSlotChain { slot });
+                mtLoop.Attach(*owned.back());
+            }
+
+            TTimer::time = 8;
+            TBatchResult batch = mtLoop.RunBatch();
+            BOOST_CHECK_EQUAL(batch.done, 3);
+            BOOST_CHECK_EQUAL(batch.nextWakeTime, 9);
+            BOOST_CHECK_EQUAL(owned[1]->GetLTime(), 53);
+            BOOST_CHECK_EQUAL(owned[3]->GetLTime(), 55);
+            BOOST_CHECK_EQUAL(owned[0]->GetLTime(), 57);
+            BOOST_REQUIRE_EQUAL(batchLog.logLines.size(), 3);
+            if (policy != DISPATCH_ROUND_ROBIN) {
+                BOOST_CHECK_EQUAL(batchLog.logLines[0], "A");
+                BOOST_CHECK_EQUAL(batchLog.logLines[1], "B");
+                BOOST_CHECK_EQUAL(batchLog.logLines[2], "C");
+            } else {
+                BOOST_CHECK_EQUAL(batchLog.logLines[0], "C");
+                BOOST_CHECK_EQUAL(batchLog.logLines[1], "A");
+                BOOST_CHECK_EQUAL(batchLog.logLines[2], "B");
+            }
+            batch = mtLoop.RunBatch();
+            BOOST_CHECK_EQUAL(batch.done, 0);
+            BOOST_CHECK_EQUAL(batch.nextWakeTime, 9);
+            BOOST_CHECK_EQUAL(batchLog.logLines.size(), 3);
+        }
+        TTimer::time = 1;
+    }
+
+
+    // Бюджет пачки: новые задачи не начинаются после его исчерпания
+    BOOST_FIXTURE_TEST_CASE( testTLoopRunBatchBudget, TTimeSlotFixture ) {
+        TLoop mtLoop {10, log};
+        for (int i = 0; i < 5; ++i)
+            mtLoop.Attach({ { { [](TLog&){ TTimer::time += 10; return true; } }, 1000, 0 } });
+        mtLoop.Attach({ { { [](TLog& log){ log.Log("BUSY"); return false; } }, 1000, 0 } });
+
+        TTimer::time = 100;
+        TBatchResult batch = mtLoop.RunBatch(25);
+        BOOST_CHECK_EQUAL(batch.done, 3);
+        BOOST_CHECK_EQUAL(TTimer::time, 130);
+        // Оставшаяся работа уже просрочена
+        BOOST_CHECK(!TimeAfter(batch.nextWakeTime, TTimer::time));
+        batch = mtLoop.RunBatch(25);
+        BOOST_CHECK_EQUAL(batch.done, 2);
+        // Отказывающаяся задача не зацикливает пачку
+        BOOST_CHECK_GE(log.logLines.size(), 1);
+        BOOST_CHECK_EQUAL(mtLoop.RunBatch().done, 0);
+        TTimer::time = 1;
+    }
+
+
+    // TFixedLoop не обращается к куче ни в Attach, ни в Run
+    static size_t fixedRuns = 0;
+    struct TFixedTask: public IRunnable {
+        virtual bool Run(TLog&) {
+            fixedRuns++;
+            return true;
+        }
+    } fixedTask;
+
+    BOOST_FIXTURE_TEST_CASE( testTFixedLoopNoHeap, TTimeSlotFixture ) {
+        {
+            fixedRuns = 0;
+            TFixedLoop<2, 3> mtLoop {log};
+            size_t allocs = allocCount;
+
+            BOOST_CHECK(mtLoop.Attach({
+                { { [](TLog&){ fixedRuns++; return true; } }, 100, 10 },
+                { { [](){ fixedRuns++; } }, 100, 20 },
+                { fixedTask, 50, 10 }
+            }) != INVALID_CHAIN);
+            BOOST_CHECK(mtLoop.Attach({
+                { { [](TLog&){ fixedRuns++; return true; } }, 30, 0 }
+            }) != INVALID_CHAIN);
+            // Не больше MaxChains цепочек
+            BOOST_CHECK_EQUAL(mtLoop.Attach({
+                { { [](TLog&){ fixedRuns++; return true; } }, 30, 0 }
+            }), INVALID_CHAIN);
+
+            for (TTimer::time = 1; TTimer::time < 1000; TTimer::time++)
+                mtLoop.Run();
+            BOOST_CHECK_EQUAL(allocCount, allocs);
+            BOOST_CHECK_EQUAL(fixedRuns, 12 + 34);
+        }
+    }
+
+
+    // Цепочка длиннее MaxSlots не подключается
+    BOOST_FIXTURE_TEST_CASE( testTFixedLoopMaxSlots, TTimeSlotFixture ) {
+        {
+            TFixedLoop<2, 1> mtLoop {log};
+            BOOST_CHECK_EQUAL(mtLoop.Attach({
+                { { [](TLog&){ return true; } }, 30, 0 },
+                { { [](TLog&){ return true; } }, 30, 0 }
+            }), INVALID_CHAIN);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+        }
+    }
+
+
+    // Задача, переданная указателем, удаляется ровно один раз
+    static int liveTasks = 0;
+    struct TCountedTask: public IRunnable {
+        TCountedTask() { liveTasks++; }
+        ~TCountedTask() { liveTasks--; }
+        virtual bool Run(TLog& log) {
+            log.Log("COUNTED IS RUN");
+            return true;
+        }
+    };
+
+    BOOST_FIXTURE_TEST_CASE( testTTskPtrAdapterOwnership, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log};
+            mtLoop.Attach({ { new TCountedTask(), 100, 0 } });
+            BOOST_CHECK_EQUAL(liveTasks, 1);
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 1);
+        }
+        BOOST_CHECK_EQUAL(liveTasks, 0);
+    }
+
+
+    // Копии тайм-слота с задачей по указателю выполняют одну и ту же задачу
+    BOOST_FIXTURE_TEST_CASE( testTTskPtrAdapterCopy, TTimeSlotFixture ) {
+        {
+            TTimeSlotChain chain { { new TCountedTask(), 100, 0 }, { new TCountedTask(), 100, 0 } };
+            BOOST_CHECK_EQUAL(liveTasks, 2);
+            TTimeSlot copy = chain.At(0);
+            chain.Insert(0, copy);
+            chain.Remove(1);
+            BOOST_CHECK_EQUAL(liveTasks, 2);
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(copy.Run(log), true);
+            BOOST_CHECK_EQUAL(chain.Run(log), true);
+            TTimer::time = 200;
+            BOOST_CHECK_EQUAL(chain.Run(log), true);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 3);
+        }
+        BOOST_CHECK_EQUAL(liveTasks, 0);
+    }
+
+
+    // Лямбда с захватом хранится внутри TCallable
+    BOOST_FIXTURE_TEST_CASE( testTCallableCapture, TTimeSlotFixture ) {
+        {
+            int runs = 0;
+            TMockLog* pLog = &log;
+            TFixedLoop<1, 2> mtLoop {log};
+            size_t allocs = allocCount;
+            mtLoop.Attach({
+                { { [&runs](TLog&){ runs++; return true; } }, 10, 0 },
+                { { [&runs, pLog](){ runs += 10; pLog->Log("CAPTURE IS RUN"); } }, 10, 0 }
+            });
+            BOOST_CHECK_EQUAL(allocCount, allocs);
+
+            TTimer::time = 1;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            TTimer::time = 11;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(runs, 11);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 1);
+            BOOST_CHECK_EQUAL(log.logLines[0], "CAPTURE IS RUN");
+        }
+    }
+
+
+    // Задача void(TLog&) считается выполненной
+    BOOST_AUTO_TEST_CASE( testTCallableVoidLog ) {
+        TMockLog log;
+        TCallable task {[](TLog& log){ log.Log("VOID IS RUN"); }};
+        BOOST_CHECK_EQUAL(task(log), true);
+        BOOST_REQUIRE_EQUAL(log.logLines.size(), 1);
+        BOOST_CHECK_EQUAL(log.logLines[0], "VOID IS RUN");
+    }
+
+
+    // Большой функтор размещается в куче, копии независимы
+    struct TBigTask {
+        char payload[4 * CALLABLE_STORAGE_SIZE];
+        int* runs;
+        bool operator()(TLog&) {
+            (*runs)++;
+            return payload[0] == 'x';
+        }
+    };
+
+    BOOST_AUTO_TEST_CASE( testTCallableHeap ) {
+        TMockLog log;
+        int runs = 0;
+        TBigTask big;
+        big.payload[0] = 'x';
+        big.runs = &runs;
+        {
+            TCallable c1 {big};
+            TCallable c2 {c1};
+            c1 = c2;
+            BOOST_CHECK_EQUAL(c1(log), true);
+            BOOST_CHECK_EQUAL(c2(log), true);
+        }
+        BOOST_CHECK_EQUAL(runs, 2);
+    }
+
+
+    // Цепочки, известные на этапе компиляции
+    bool StaticTask1(TLog& log) {
+        log.Log("S1 IS RUN");
+        return true;
+    }
+    bool StaticTask2(TLog& log) {
+        log.Log("S2 IS RUN");
+        return true;
+    }
+    static int staticDummyRuns = 0;
+    void StaticDummyTask() {
+        staticDummyRuns++;
+    }
+
+    using TMyStaticChain = TStaticChain<
+        TStaticSlot<StaticTask1, 100, 10>,
+        TStaticSlot<StaticTask2, 50, 0>
+    >;
+
+    BOOST_FIXTURE_TEST_CASE( testTStaticChain01, TTimeSlotFixture ) {
+        {
+            TMyStaticChain chain;
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(chain.Run(log), true);
+            BOOST_CHECK_EQUAL(chain.GetLTime(), 101);
+            BOOST_CHECK_EQUAL(chain.GetStat(0).GetStartTime(), 10);
+
+            TTimer::time = 100;
+            BOOST_CHECK_EQUAL(chain.Run(log), false);
+
+            // Задача выполняется дольше минимальной длительности тайм-слота
+            TTimer::time = 101;
+            TTimer::increment = 100;
+            BOOST_CHECK_EQUAL(chain.Run(log), true);
+            TTimer::increment = 0;
+            // Время читается до задачи и после нее
+            BOOST_CHECK_EQUAL(chain.GetStat(1).GetStartTime(), 101);
+            BOOST_CHECK_EQUAL(chain.GetStat(1).GetStopTime(), 201);
+            BOOST_CHECK_EQUAL(chain.GetLTime(), 202);
+
+            BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+            BOOST_CHECK_EQUAL(log.logLines[0], "S1 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[1], "S2 IS RUN");
+        }
+    }
+
+
+    // Статические и динамические цепочки в одном TLoop
+    BOOST_FIXTURE_TEST_CASE( testTStaticChainInTLoop, TTimeSlotFixture ) {
+        {
+            TMyStaticChain staticChain;
+            TLoop mtLoop {10, log};
+            mtLoop.Attach(staticChain);
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"D1 IS RUN"); return true; } }, 100, 0 }
+            });
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 2);
+            TTimer::time = 101;
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 2);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 4);
+            BOOST_CHECK_EQUAL(log.logLines[0], "S1 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[1], "D1 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[2], "S2 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[3], "D1 IS RUN");
+        }
+    }
+
+
+    BOOST_FIXTURE_TEST_CASE( testTStaticLoop, TTimeSlotFixture ) {
+        {
+            staticDummyRuns = 0;
+            TStaticLoop<
+                TMyStaticChain,
+                TStaticChain<TStaticDummySlot<StaticDummyTask, 30, 0>>
+            > mtLoop {log};
+
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 31);
+
+            TTimer::time = 31;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(staticDummyRuns, 2);
+            BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 61);
+            BOOST_CHECK_EQUAL(mtLoop.GetChain<0>().GetLTime(), 101);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 1);
+        }
+    }
+
+
+    // Разовые задачи
+    BOOST_FIXTURE_TEST_CASE( testTLoopPostAfter, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log};
+            TTimer::time = 10;
+            TTimerHandle h1 = mtLoop.PostAfter(20, { [](TLog& log){ log.Log((char*)"T1 IS RUN"); return true; } });
+            TTimerHandle h2 = mtLoop.PostAt(25, { [](TLog& log){ log.Log((char*)"T2 IS RUN"); return true; } });
+            TTimerHandle h3 = mtLoop.PostAt(27, { [](TLog& log){ log.Log((char*)"T3 IS RUN"); return true; } });
+            BOOST_CHECK(h1 != INVALID_TIMER);
+            BOOST_CHECK(h2 != INVALID_TIMER);
+            BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 25);
+            BOOST_CHECK_EQUAL(mtLoop.Cancel(h3), true);
+            BOOST_CHECK_EQUAL(mtLoop.Cancel(h3), false);
+
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            TTimer::time = 25;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(mtLoop.Cancel(h2), false);
+
+            BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(TTimer::SleepUntil), 1);
+            BOOST_CHECK_EQUAL(TTimer::time, 30);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+            BOOST_CHECK_EQUAL(log.logLines[0], "T2 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[1], "T1 IS RUN");
+        }
+    }
+
+
+    // Разовые задачи и цепочки выполняются в порядке сроков
+    BOOST_FIXTURE_TEST_CASE( testTLoopPostWithChains, TTimeSlotFixture ) {
+        {
+            TLoop mtLoop {10, log, DISPATCH_DEADLINE};
+            mtLoop.Attach({
+                { { [](TLog& log){ log.Log((char*)"A1 IS RUN"); return true; } }, 100, 0 },
+                { { [](TLog& log){ log.Log((char*)"A2 IS RUN"); return true; } }, 100, 0 }
+            });
+            TTimer::time = 10;
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 1);
+            mtLoop.PostAt(150, { [](TLog& log){ log.Log((char*)"T1 IS RUN"); return true; } });
+            mtLoop.PostAt(50, { [](TLog& log){ log.Log((char*)"T2 IS RUN"); return true; } });
+
+            TTimer::time = 200;
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 3);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 4);
+            BOOST_CHECK_EQUAL(log.logLines[1], "T2 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[2], "A2 IS RUN");
+            BOOST_CHECK_EQUAL(log.logLines[3], "T1 IS RUN");
+        }
+    }
+
+
+    // Каждый таймер срабатывает при первом проходе, когда его срок наступил
+    BOOST_AUTO_TEST_CASE( testTTimerWheelRandom ) {
+        struct TFired {
+            size_t id;
+            tick_t time;
+        };
+        std::mt19937 rnd(42);
+        std::vector<TFired> fired;
+        std::vector<tick_t> expire;
+        std::vector<TTimerHandle> handles;
+        std::vector<bool> cancelled;
+        TMockLog log;
+        TLoop mtLoop {1, log};
+
+        TTimer::time = 1000;
+        for (size_t i = 0; i < 5000; ++i) {
+            // Сроки на всех уровнях колеса
+            tick_t delay = rnd() % (1u << (rnd() % 28));
+            std::vector<TFired>* pFired = &fired;
+            expire.push_back(TTimer::time + delay);
+            handles.push_back(mtLoop.PostAfter(delay, { [pFired, i](TLog&){
+                pFired->push_back({ i, TTimer::time });
+                return true;
+            } }));
+            cancelled.push_back(rnd() % 10 == 0);
+        }
+        for (size_t i = 0; i < handles.size(); ++i)
+            if (cancelled[i])
+                BOOST_CHECK_EQUAL(mtLoop.Cancel(handles[i]), true);
+
+        std::vector<tick_t> passes;
+        while (TTimer::time < 1000 + (1u << 27)) {
+            TTimer::time += rnd() % (1u << (rnd() % 20));
+            passes.push_back(TTimer::time);
+            mtLoop.RunUntilIdle();
+        }
+
+        size_t expected = 0;
+        for (size_t i = 0; i < handles.size(); ++i)
+            if (!cancelled[i])
+                expected++;
+        BOOST_CHECK_EQUAL(fired.size(), expected);
+        for (const auto& f : fired) {
+            BOOST_CHECK(!cancelled[f.id]);
+            tick_t due = *std::lower_bound(passes.begin(), passes.end(), expire[f.id]);
+            BOOST_CHECK_EQUAL(f.time, due);
+        }
+    }
+
+
+    // Задача, вернувшая false, повторяется; TFixedLoop хранит таймеры внутри себя
+    BOOST_FIXTURE_TEST_CASE( testTFixedLoopTimers, TTimeSlotFixture ) {
+        {
+            TTimer::time = 10;
+            TFixedLoop<1, 1, 2> mtLoop {log};
+            TFixedLoop<1, 1> noTimers {log};
+            BOOST_CHECK_EQUAL(noTimers.PostAfter(10, { [](TLog&){ return true; } }), INVALID_TIMER);
+
+            static int attempts = 0;
+            attempts = 0;
+            size_t allocs = allocCount;
+            BOOST_CHECK(mtLoop.PostAfter(5, { [](TLog&){ return ++attempts == 2; } }) != INVALID_TIMER);
+            BOOST_CHECK(mtLoop.PostAfter(5, { [](TLog&){ return true; } }) != INVALID_TIMER);
+            BOOST_CHECK_EQUAL(mtLoop.PostAfter(5, { [](TLog&){ return true; } }), INVALID_TIMER);
+
+            TTimer::time = 15;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+            BOOST_CHECK_EQUAL(attempts, 2);
+            BOOST_CHECK_EQUAL(allocCount, allocs);
+        }
+    }
+
+
+    // Тайм-слоты одной цепочки в TParallelLoop не пересекаются и идут по порядку
+    struct TOrderCheck {
+        std::atomic<int> active;
+        size_t nextSlot = 0;
+        size_t runs = 0;
+        size_t violations = 0;
+
+        TOrderCheck(): active(0) { }
+        bool Run(size_t slot) {
+            if (active.fetch_add(1) != 0)
+                violations++;
+            if (slot != nextSlot)
+                violations++;
+            nextSlot = (slot + 1) % 3;
+            runs++;
+            active.fetch_sub(1);
+            return true;
+        }
+    };
+
+    BOOST_AUTO_TEST_CASE( testTParallelLoopOrder ) {
+        const size_t chainCount = 32;
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        std::vector<TOrderCheck> checks(chainCount);
+        TParallelLoop mtLoop {4, chainCount};
+        for (auto& check : checks) {
+            TOrderCheck* p = &check;
+            BOOST_CHECK(mtLoop.Attach({
+                { { [p](TLog&){ return p->Run(0); } }, 1, 0 },
+                { { [p](TLog&){ return p->Run(1); } }, 1, 0 },
+                { { [p](TLog&){ return p->Run(2); } }, 1, 0 }
+            }));
+        }
+        mtLoop.Start();
+        BOOST_CHECK_EQUAL(mtLoop.Attach({ { [](TLog&){ return true; } } }), INVALID_CHAIN);
+        for (size_t t = 0; t < 500; ++t) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            TTimer::time++;
+        }
+        mtLoop.Stop();
+
+        size_t runs = 0;
+        for (const auto& check : checks) {
+            BOOST_CHECK_EQUAL(check.violations, 0);
+            BOOST_CHECK(check.runs > 0);
+            runs += check.runs;
+        }
+        BOOST_CHECK_EQUAL(mtLoop.GetRunCount(), runs);
+    }
+
+    // Свободный поток забирает готовую цепочку у потока, занятого долгой задачей
+    BOOST_AUTO_TEST_CASE( testTParallelLoopSteal ) {
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        static std::atomic<bool> stolenRan;
+        stolenRan = false;
+        TParallelLoop mtLoop {2, 3};
+        // Цепочки 0 и 2 достаются потоку 0, цепочка 1 - потоку 1
+        mtLoop.Attach({ { [](TLog&){
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (!stolenRan && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::yield();
+            return true;
+        } } });
+        mtLoop.Attach({ { [](TLog&){ return true; } } });
+        mtLoop.Attach({ { [](TLog&){ stolenRan = true; return true; } } });
+        mtLoop.Start();
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (mtLoop.GetRunCount() < 3 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+        mtLoop.Stop();
+        BOOST_CHECK(stolenRan);
+        BOOST_CHECK_EQUAL(mtLoop.GetRunCount(), 3);
+        BOOST_CHECK_EQUAL(mtLoop.GetStealCount(), 1);
+    }
+
+    // Отсоединение цепочек TParallelLoop при остановленных потоках
+    BOOST_AUTO_TEST_CASE( testTParallelLoopDetach ) {
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        static std::atomic<int> runsA, runsB;
+        runsA = 0;
+        runsB = 0;
+        TTimeSlotChain chainC {{ { [](TLog&){ return true; }, 1, 0 } }};
+        TParallelLoop mtLoop {2, 3};
+        TChainHandle a = mtLoop.Attach({ { [](TLog&){ runsA++; return true; }, 1, 0 } });
+        TChainHandle b = mtLoop.Attach({ { [](TLog&){ runsB++; return true; }, 1, 0 } });
+        BOOST_CHECK(mtLoop.Attach(chainC) != INVALID_CHAIN);
+        BOOST_CHECK(a != INVALID_CHAIN && b != INVALID_CHAIN);
+        BOOST_CHECK(mtLoop.Detach(a));
+        BOOST_CHECK(!mtLoop.Detach(a));
+        BOOST_CHECK(mtLoop.Detach(chainC));
+        // Место отсоединенной цепочки достается новой, старый дескриптор недействителен
+        TChainHandle d = mtLoop.Attach({ { [](TLog&){ return true; }, 1, 0 } });
+        BOOST_CHECK(d != INVALID_CHAIN && d != a);
+        BOOST_CHECK(!mtLoop.Detach(a));
+
+        mtLoop.Start();
+        BOOST_CHECK(!mtLoop.Detach(b));
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (mtLoop.GetRunCount() < 2 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+        mtLoop.Stop();
+        BOOST_CHECK_EQUAL(runsA, 0);
+        BOOST_CHECK_EQUAL(runsB, 1);
+        BOOST_CHECK(mtLoop.Detach(b));
+        BOOST_CHECK(mtLoop.Detach(d));
+    }
+
+    // Отсоединение цепочек и команды, выполняемые в начале Run()
+    BOOST_AUTO_TEST_CASE( testTLoopDetach ) {
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        static std::string trace;
+        trace.clear();
+        TTimeSlotChain chainA {{ { [](TLog&){ trace += "A"; return true; } }, 1, 0 }};
+        TTimeSlotChain chainB {{ { [](TLog&){ trace += "B"; return true; } }, 1, 0 }};
+        TTimeSlotChain chainC {{ { [](TLog&){ trace += "C"; return true; } }, 1, 0 }};
+        TLoop mtLoop {2, defaultLog, DISPATCH_ROUND_ROBIN};
+
+        BOOST_CHECK(mtLoop.Attach(chainA));
+        BOOST_CHECK(mtLoop.Attach(chainB));
+        BOOST_CHECK(mtLoop.Detach(chainA));
+        BOOST_CHECK_EQUAL(mtLoop.Detach(chainA), false);
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 1);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK_EQUAL(trace, "B");
+
+        // Команды выполняются в порядке отправки при следующем Run()
+        TLoopCommand attachC {COMMAND_ATTACH, chainC};
+        TLoopCommand detachB {COMMAND_DETACH, chainB};
+        TLoopCommand setPolicy {DISPATCH_DEADLINE};
+        TLoopCommand call {{ [](TLog&){ trace += "!"; return true; } }};
+        mtLoop.Submit(attachC);
+        mtLoop.Submit(detachB);
+        mtLoop.Submit(setPolicy);
+        mtLoop.Submit(call);
+        BOOST_CHECK_EQUAL(attachC.IsDone(), false);
+        TTimer::time = 2;
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK(attachC.IsDone() && attachC.GetResult());
+        BOOST_CHECK(detachB.IsDone() && detachB.GetResult());
+        BOOST_CHECK(call.IsDone() && call.GetResult());
+        BOOST_CHECK_EQUAL(mtLoop.GetDispatchPolicy(), DISPATCH_DEADLINE);
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 1);
+        BOOST_CHECK_EQUAL(trace, "B!C");
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+    }
+
+    // Таблица цепочек растет, дескрипторы и порядок куч сохраняются
+    BOOST_FIXTURE_TEST_CASE( testTLoopGrow, TTimeSlotFixture ) {
+        TTimer::time = 1;
+        TLoop mtLoop {2, log, DISPATCH_PRIORITY};
+        TChainHandle a = mtLoop.Attach({ { { [](TLog& log){ log.Log("A"); return true; } }, 10, 0 } });
+        TChainHandle b = mtLoop.Attach({ { { [](TLog& log){ log.Log("B"); return true; } }, 10, 0 } });
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        // B ждет в куче готовых, пока таблица растет
+        TChainHandle c = mtLoop.Attach({ { { [](TLog& log){ log.Log("C"); return true; } }, 10, 0 } });
+        BOOST_REQUIRE(c != INVALID_CHAIN);
+        BOOST_CHECK(mtLoop.SetPriority(c, 1));
+        std::vector<TChainHandle> more;
+        for (int i = 0; i < 5; ++i)
+            more.push_back(mtLoop.Attach({ { { [](TLog&){ return true; } }, 1000, 0 } }));
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 8);
+        BOOST_CHECK(mtLoop.GetChain(a) != nullptr && mtLoop.GetChain(b) != nullptr);
+        for (TChainHandle h : more)
+            BOOST_CHECK(mtLoop.Detach(h));
+
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+        TTimer::time = 11;
+        BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 3);
+        BOOST_REQUIRE_EQUAL(log.logLines.size(), 6);
+        const char* order[] = { "A", "C", "B", "C", "A", "B" };
+        for (size_t i = 0; i < 6; ++i)
+            BOOST_CHECK_EQUAL(log.logLines[i], order[i]);
+        TTimer::time = 1;
+    }
+
+    // Пустой список тайм-слотов не подключается
+    BOOST_FIXTURE_TEST_CASE( testTLoopAttachEmpty, TTimeSlotFixture ) {
+        TLoop mtLoop {2, log};
+        TFixedLoop<1, 1> fixedLoop {log};
+        TParallelLoop parallelLoop {1, 2, log};
+        BOOST_CHECK_EQUAL(mtLoop.Attach({}), INVALID_CHAIN);
+        BOOST_CHECK_EQUAL(fixedLoop.Attach({}), INVALID_CHAIN);
+        BOOST_CHECK_EQUAL(parallelLoop.Attach({}), INVALID_CHAIN);
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 0);
+        BOOST_CHECK_EQUAL(fixedLoop.GetChainCount(), 0);
+    }
+
+    // Несколько потоков отправляют команды, пока поток TLoop выполняет цепочки
+    BOOST_AUTO_TEST_CASE( testTLoopSubmitStress ) {
+        const size_t producerCount = 4;
+        const size_t iterations = 500;
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        TLoop mtLoop {producerCount * 2};
+        std::atomic<size_t> finished(0);
+        std::vector<size_t> failures(producerCount, 0);
+        std::vector<size_t> runs(producerCount * 2, 0);
+        std::vector<std::unique_ptr<TTimeSlotChain>> chains;
+        for (size_t i = 0; i < producerCount * 2; ++i) {
+            size_t* counter = &runs[i];
+            chains.emplace_back(new TTimeSlotChain {{ { [counter](TLog&){ ++*counter; return true; } }, 1, 0 }});
+        }
+
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < producerCount; ++p) {
+            producers.emplace_back([&, p]() {
+                TTimeSlotChain& first = *chains[2 * p];
+                TTimeSlotChain& second = *chains[2 * p + 1];
+                for (size_t i = 0; i < iterations; ++i) {
+                    // Команды одного отправителя не ждут друг друга - проверяем порядок
+                    TLoopCommand attachFirst {COMMAND_ATTACH, first};
+                    TLoopCommand attachSecond {COMMAND_ATTACH, second};
+                    TLoopCommand detachFirst {COMMAND_DETACH, first};
+                    TLoopCommand setPolicy {i % 2 ? DISPATCH_DEADLINE : DISPATCH_ROUND_ROBIN};
+                    TLoopCommand detachSecond {COMMAND_DETACH, second};
+                    mtLoop.Submit(attachFirst);
+                    mtLoop.Submit(attachSecond);
+                    mtLoop.Submit(detachFirst);
+                    mtLoop.Submit(setPolicy);
+                    mtLoop.Submit(detachSecond);
+                    while (!detachSecond.IsDone())
+                        std::this_thread::yield();
+                    while (!attachFirst.IsDone() || !attachSecond.IsDone() || !detachFirst.IsDone() || !setPolicy.IsDone())
+                        std::this_thread::yield();
+                    if (!attachFirst.GetResult() || !attachSecond.GetResult()
+                            || !detachFirst.GetResult() || !detachSecond.GetResult())
+                        failures[p]++;
+                }
+                finished++;
+            });
+        }
+        while (finished < producerCount) {
+            TTimer::time++;
+            mtLoop.RunUntilIdle();
+        }
+        for (auto& producer : producers)
+            producer.join();
+        mtLoop.Run();
+
+        for (size_t p = 0; p < producerCount; ++p)
+            BOOST_CHECK_EQUAL(failures[p], 0);
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 0);
+    }
+
+    // Дескрипторы цепочек: свободные места переиспользуются, устаревшие дескрипторы недействительны
+    BOOST_AUTO_TEST_CASE( testTLoopDetachHandle ) {
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        static std::string trace;
+        trace.clear();
+        TLoop mtLoop {3, defaultLog, DISPATCH_ROUND_ROBIN};
+        TChainHandle a = mtLoop.Attach({ { { [](TLog&){ trace += "A"; return true; } }, 1, 0 } });
+        TChainHandle b = mtLoop.Attach({ { { [](TLog&){ trace += "B"; return true; } }, 1, 0 } });
+        TChainHandle c = mtLoop.Attach({ { { [](TLog&){ trace += "C"; return true; } }, 1, 0 } });
+        BOOST_CHECK(a != INVALID_CHAIN && b != INVALID_CHAIN && c != INVALID_CHAIN);
+
+        BOOST_CHECK(mtLoop.Detach(b));
+        BOOST_CHECK_EQUAL(mtLoop.Detach(b), false);
+        BOOST_CHECK(mtLoop.GetChain(b) == nullptr);
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 2);
+        for (int i = 0; i < 4; ++i) {
+            TTimer::time++;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        }
+        // Новая цепочка занимает место B и встает в круг на его позицию
+        TChainHandle d = mtLoop.Attach({ { { [](TLog&){ trace += "D"; return true; } }, 1, 0 } });
+        BOOST_CHECK(d != INVALID_CHAIN && d != b);
+        BOOST_CHECK_EQUAL(mtLoop.Detach(b), false);
+        BOOST_CHECK(mtLoop.GetChain(d) != nullptr);
+        for (int i = 0; i < 3; ++i) {
+            TTimer::time++;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        }
+        BOOST_CHECK_EQUAL(trace, "ACACADC");
+
+        // В режиме сроков отсоединенная цепочка тоже не выполняется
+        mtLoop.SetDispatchPolicy(DISPATCH_DEADLINE);
+        BOOST_CHECK(mtLoop.Detach(a));
+        BOOST_CHECK(mtLoop.Detach(c));
+        trace.clear();
+        TTimer::time++;
+        BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 1);
+        BOOST_CHECK_EQUAL(trace, "D");
+    }
+
+    // Подключение и отсоединение цепочек TFixedLoop не обращается к куче
+    BOOST_FIXTURE_TEST_CASE( testTFixedLoopDetach, TTimeSlotFixture ) {
+        TFixedLoop<2, 2> mtLoop {log};
+        size_t allocs = allocCount;
+        TChainHandle keep = mtLoop.Attach({ { { [](TLog&){ return true; } }, 1, 0 } });
+        for (int i = 0; i < 100; ++i) {
+            TChainHandle h = mtLoop.Attach({
+                { { [](TLog&){ return true; } }, 1, 0 },
+                { { [](){ } }, 1, 0 }
+            });
+            BOOST_CHECK(h != INVALID_CHAIN);
+            BOOST_CHECK(mtLoop.Detach(h));
+        }
+        BOOST_CHECK(mtLoop.GetChain(keep) != nullptr);
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 1);
+        BOOST_CHECK_EQUAL(allocCount, allocs);
+    }
+
+    // Задача отсоединяет свою цепочку: цепочка отсоединяется после выхода из Run
+    BOOST_FIXTURE_TEST_CASE( testTLoopSelfDetach, TTimeSlotFixture ) {
+        for (TDispatchPolicy policy : { DISPATCH_ROUND_ROBIN, DISPATCH_DEADLINE, DISPATCH_PRIORITY }) {
+            TTimer::time = 1;
+            TLoop mtLoop {4, log, policy};
+            TLoop* pLoop = &mtLoop;
+            TChainHandle self = INVALID_CHAIN;
+            TChainHandle* pSelf = &self;
+            int runs = 0;
+            int* pRuns = &runs;
+            self = mtLoop.Attach({ { { [pLoop, pSelf](TLog&){ return pLoop->Detach(*pSelf); } }, 10, 0 } });
+            mtLoop.Attach({ { { [pRuns](){ (*pRuns)++; } }, 10, 0 } });
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 2);
+            BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 1);
+            BOOST_CHECK(mtLoop.GetChain(self) == nullptr);
+            // Место отсоединенной цепочки занимает новая
+            BOOST_CHECK(mtLoop.Attach({ { { [pRuns](){ (*pRuns)++; } }, 10, 0 } }) != INVALID_CHAIN);
+            TTimer::time = 11;
+            BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 2);
+            BOOST_CHECK_EQUAL(runs, 3);
+        }
+    }
+
+    // Добавление и удаление тайм-слотов без пересоздания цепочки
+    BOOST_AUTO_TEST_CASE( testTTimeSlotChainInsertRemove ) {
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        static std::string trace;
+        trace.clear();
+        TLoop mtLoop {1};
+        TChainHandle h = mtLoop.Attach({
+            { { [](TLog&){ trace += "A"; return true; } }, 1, 0 },
+            { { [](TLog&){ trace += "B"; return true; } }, 1, 0 }
+        });
+        IChain* chain = mtLoop.GetChain(h);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        TTimer::time++;
+
+        // Вставка перед текущим тайм-слотом B: B остается следующим
+        BOOST_CHECK(chain->Insert(1, { { [](TLog&){ trace += "C"; return true; } }, 1, 0 }));
+        BOOST_CHECK(chain->Insert(3, { { [](TLog&){ trace += "D"; return true; } }, 1, 0 }));
+        BOOST_CHECK_EQUAL(chain->Insert(5, { { [](TLog&){ return true; } }, 1, 0 }), false);
+        for (int i = 0; i < 5; ++i) {
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            TTimer::time++;
+        }
+        BOOST_CHECK_EQUAL(trace, "ABDACB");
+
+        // Статистика оставшихся тайм-слотов сохраняется
+        TTimeSlotChain* slots = static_cast<TTimeSlotChain*>(chain);
+        tick_t bStart = slots->At(2).GetStat().GetStartTime();
+        BOOST_CHECK(chain->Remove(0));
+        BOOST_CHECK(chain->Remove(0));
+        BOOST_CHECK(chain->Remove(1));
+        BOOST_CHECK_EQUAL(chain->Remove(0), false);
+        BOOST_CHECK_EQUAL(slots->Size(), 1);
+        BOOST_CHECK_EQUAL(slots->At(0).GetStat().GetStartTime(), bStart);
+        trace.clear();
+        BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        BOOST_CHECK_EQUAL(trace, "B");
+
+        // Цепочка во внешней памяти не растет
+        TFixedTimeSlotChain<1> fixedChain {{ { [](TLog&){ return true; } }, 1, 0 }};
+        BOOST_CHECK_EQUAL(fixedChain.Insert(0, { { [](TLog&){ return true; } }, 1, 0 }), false);
+    }
+
+#if MTLOOP_STAT_HISTOGRAM
+    // Корзины гистограммы: точные до 2^SUB_BITS, дальше - логарифмические
+    BOOST_AUTO_TEST_CASE( testTHistogram ) {
+        for (tick_t v = 0; v < 100000; v = v * 3 / 2 + 1) {
+            size_t bucket = THistogram::BucketOf(v);
+            BOOST_CHECK(bucket < THistogram::BUCKETS);
+            BOOST_CHECK(THistogram::BucketLow(bucket) <= v);
+            BOOST_CHECK(THistogram::BucketHigh(bucket) >= v);
+            // Ширина корзины не больше 2^-SUB_BITS от значения
+            BOOST_CHECK(THistogram::BucketHigh(bucket) - THistogram::BucketLow(bucket) <= (v >> THistogram::SUB_BITS));
+        }
+        BOOST_CHECK_EQUAL(THistogram::BucketOf(static_cast<tick_t>(-1)), THistogram::BUCKETS - 1);
+
+        THistogram histogram;
+        for (tick_t v = 1; v <= 100; ++v)
+            histogram.Record(v);
+        histogram.Record(5000);
+        BOOST_CHECK_EQUAL(histogram.GetCount(), 101);
+        BOOST_CHECK_EQUAL(histogram.GetMin(), 1);
+        BOOST_CHECK_EQUAL(histogram.GetMax(), 5000);
+        BOOST_CHECK_CLOSE(histogram.GetMean(), (5050.0 + 5000) / 101, 1e-9);
+        tick_t p50 = histogram.GetPercentile(50);
+        BOOST_CHECK(p50 >= 51 && p50 <= 51 + 51 / 4);
+        BOOST_CHECK_EQUAL(histogram.GetPercentile(100), 5000);
+        histogram.Reset();
+        BOOST_CHECK_EQUAL(histogram.GetCount(), 0);
+        BOOST_CHECK_EQUAL(histogram.GetPercentile(99), 0);
+    }
+
+    // Длительность и опоздание старта каждого выполнения тайм-слота
+    BOOST_AUTO_TEST_CASE( testTStatHistogram ) {
+        TTimer::time = 1;
+        TTimer::increment = 0;
+        TLoop mtLoop {1};
+        static tick_t work = 0;
+        TChainHandle h = mtLoop.Attach({
+            { { [](TLog&){ TTimer::time += work; return true; } }, 100, 0 }
+        });
+        TTimeSlotChain* chain = static_cast<TTimeSlotChain*>(mtLoop.GetChain(h));
+        // Запуски с опозданием 0, 10, 20 и длительностью 5, 15, 25
+        for (tick_t i = 0; i < 3; ++i) {
+            TTimer::time = 1 + 100 * i + 10 * i;
+            work = 5 + 10 * i;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+        }
+        TStat& stat = chain->At(0).GetStat();
+        THistogram& duration = stat.GetDurationHistogram();
+        THistogram& lateness = stat.GetLatenessHistogram();
+        BOOST_CHECK_EQUAL(duration.GetCount(), 3);
+        BOOST_CHECK_EQUAL(duration.GetMin(), 5);
+        BOOST_CHECK_EQUAL(duration.GetMax(), 25);
+        BOOST_CHECK_CLOSE(duration.GetMean(), 15.0, 1e-9);
+        BOOST_CHECK_EQUAL(lateness.GetCount(), 3);
+        BOOST_CHECK_EQUAL(lateness.GetMin(), 0);
+        BOOST_CHECK_EQUAL(lateness.GetMax(), 20);
+    }
+#endif
+
+    // Одна долгая задача: сдвиг расписания по политикам выхода за бюджет
+    struct TOverrunTrace {
+        static std::string trace;
+        static std::vector<tick_t> starts;
+        static size_t hookCalls;
+
+        static bool Task(char name, tick_t work) {
+            trace += name;
+            starts.push_back(TTimer::time);
+            TTimer::time += work;
+            return true;
+        }
+        static void Hook(TTimeSlot& slot, TLog& log) {
+            hookCalls++;
+        }
+        // Цепочка A, B, C по 10 тиков; первое выполнение A длится 25 тиков
+        static TTimeSlotChain* Run(TOverrunPolicy policy, TLog& log) {
+            trace.clear();
+            starts.clear();
+            hookCalls = 0;
+            TTimer::time = 1;
+            TTimer::increment = 0;
+            static bool slow;
+            slow = true;
+            TTimeSlotChain* chain = new TTimeSlotChain {
+                { { [](TLog&){ bool s = slow; slow = false; return Task('A', s ? 25 : 0); } }, 10, 0 },
+                { { [](TLog&){ return Task('B', 0); } }, 10, 0 },
+                { { [](TLog&){ return Task('C', 0); } }, 10, 0 }
+            };
+            chain->SetOverrunPolicy(policy, Hook);
+            for (; TTimer::time < 60; TTimer::time++)
+                chain->Run(log);
+            return chain;
+        }
+    };
+    std::string TOverrunTrace::trace;
+    std::vector<tick_t> TOverrunTrace::starts;
+    size_t TOverrunTrace::hookCalls;
+
+    BOOST_FIXTURE_TEST_CASE( testTTimeSlotChainOverrun, TTimeSlotFixture ) {
+        // Растягивание: все следующие тайм-слоты сдвинуты на 16 тиков
+        std::unique_ptr<TTimeSlotChain> chain(TOverrunTrace::Run(OVERRUN_STRETCH, log));
+        BOOST_CHECK_EQUAL(TOverrunTrace::trace, "ABCAB");
+        BOOST_CHECK((TOverrunTrace::starts == std::vector<tick_t>{ 1, 27, 37, 47, 57 }));
+        BOOST_CHECK_EQUAL(chain->At(0).GetStat().GetOverrunCount(), 1);
+        BOOST_CHECK_EQUAL(TOverrunTrace::hookCalls, 1);
+        BOOST_CHECK(log.logLines.empty());
+
+        // Лог: то же расписание и запись в TLog
+        chain.reset(TOverrunTrace::Run(OVERRUN_LOG, log));
+        BOOST_CHECK_EQUAL(TOverrunTrace::starts[3], 47);
+        BOOST_CHECK_EQUAL(log.logLines.size(), 1);
+
+        // Сжатие: B и C выполняются сразу, следующая A - по плановой сетке
+        chain.reset(TOverrunTrace::Run(OVERRUN_COMPRESS, log));
+        BOOST_CHECK_EQUAL(TOverrunTrace::trace, "ABCABC");
+        BOOST_CHECK((TOverrunTrace::starts == std::vector<tick_t>{ 1, 27, 28, 31, 41, 51 }));
+        BOOST_CHECK_EQUAL(chain->At(0).GetStat().GetOverrunCount(), 1);
+
+        // Пропуск: окно B прошло целиком, B пропускается
+        chain.reset(TOverrunTrace::Run(OVERRUN_SKIP_NEXT, log));
+        BOOST_CHECK_EQUAL(TOverrunTrace::trace, "ACABC");
+        BOOST_CHECK((TOverrunTrace::starts == std::vector<tick_t>{ 1, 27, 31, 41, 51 }));
+        BOOST_CHECK_EQUAL(chain->At(1).GetStat().GetSkipCount(), 1);
+        BOOST_CHECK_EQUAL(TOverrunTrace::hookCalls, 1);
+    }
+
+
+    // Раскладка в параллельных массивах: те же границы тайм-слотов, что у TTimeSlotChain
+    BOOST_FIXTURE_TEST_CASE( testTPackedChain, TTimeSlotFixture ) {
+        tick_t work = 0;
+        TPackedChain chain {
+            { { [&work](TLog& log){ log.Log("P1 IS RUN"); TTimer::time += work; return true; } }, 100, 10 },
+            { { [](TLog& log){ log.Log("P2 IS RUN"); return true; } }, 50, 0, 60 }
+        };
+        BOOST_CHECK_EQUAL(chain.Size(), 2);
+        BOOST_CHECK_EQUAL(chain.GetBudget(0), 100);
+        BOOST_CHECK_EQUAL(chain.GetBudget(1), 60);
+        BOOST_CHECK_EQUAL(chain.SetOverrunPolicy(OVERRUN_STRETCH, [](TTimeSlot&, TLog&){}), false);
+
+        TTimer::time = 10;
+        BOOST_CHECK_EQUAL(chain.Run(log), true);
+        BOOST_CHECK_EQUAL(chain.GetLTime(), 101);
+        BOOST_CHECK_EQUAL(chain.GetStartTime(0), 10);
+        TTimer::time = 100;
+        BOOST_CHECK_EQUAL(chain.Run(log), false);
+        TTimer::time = 101;
+        BOOST_CHECK_EQUAL(chain.Run(log), true);
+        BOOST_CHECK_EQUAL(chain.GetLTime(), 151);
+
+        // Задача дольше окна: следующий тайм-слот после padding
+        TTimer::time = 151;
+        work = 120;
+        BOOST_CHECK_EQUAL(chain.Run(log), true);
+        BOOST_CHECK_EQUAL(chain.GetStopTime(0), 271);
+        BOOST_CHECK_EQUAL(chain.GetDuration(0), 120);
+        BOOST_CHECK_EQUAL(chain.GetOverrunCount(0), 1);
+        BOOST_CHECK_EQUAL(chain.GetLTime(), 282);
+        BOOST_CHECK_EQUAL(log.logLines.size(), 3);
+        BOOST_CHECK_EQUAL(log.logLines[1], "P2 IS RUN");
+    }
+
+    BOOST_FIXTURE_TEST_CASE( testTPackedChainOverrun, TTimeSlotFixture ) {
+        static bool slow;
+        for (TOverrunPolicy policy : { OVERRUN_STRETCH, OVERRUN_COMPRESS, OVERRUN_SKIP_NEXT }) {
+            std::unique_ptr<TTimeSlotChain> reference(TOverrunTrace::Run(policy, log));
+            std::string trace = TOverrunTrace::trace;
+            std::vector<tick_t> starts = TOverrunTrace::starts;
+
+            TOverrunTrace::trace.clear();
+            TOverrunTrace::starts.clear();
+            TTimer::time = 1;
+            slow = true;
+            TPackedChain chain {
+                { { [](TLog&){ bool s = slow; slow = false; return TOverrunTrace::Task('A', s ? 25 : 0); } }, 10, 0 },
+                { { [](TLog&){ return TOverrunTrace::Task('B', 0); } }, 10, 0 },
+                { { [](TLog&){ return TOverrunTrace::Task('C', 0); } }, 10, 0 }
+            };
+            BOOST_CHECK_EQUAL(chain.SetOverrunPolicy(policy), true);
+            for (; TTimer::time < 60; TTimer::time++)
+                chain.Run(log);
+            BOOST_CHECK_EQUAL(TOverrunTrace::trace, trace);
+            BOOST_CHECK(TOverrunTrace::starts == starts);
+            BOOST_CHECK_EQUAL(chain.GetOverrunCount(0), reference->At(0).GetStat().GetOverrunCount());
+            BOOST_CHECK_EQUAL(chain.GetSkipCount(1), reference->At(1).GetStat().GetSkipCount());
+        }
+    }
+
+    BOOST_FIXTURE_TEST_CASE( testTPackedChainInTLoop, TTimeSlotFixture ) {
+        int runs = 0;
+        TPackedChain packed {
+            { { [&runs](){ runs++; } }, 20, 0 },
+            { { [&runs](){ runs += 10; } }, 20, 0 }
+        };
+        TLoop mtLoop {2, log};
+        BOOST_CHECK(mtLoop.Attach(packed) != INVALID_CHAIN);
+        mtLoop.Attach({ { { [&runs](){ runs += 100; } }, 40, 0 } });
+        TTimer::time = 1;
+        BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 2);
+        BOOST_CHECK_EQUAL(mtLoop.NextWakeTime(), 21);
+        TTimer::time = 21;
+        BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 1);
+        BOOST_CHECK_EQUAL(runs, 111);
+        mtLoop.Detach(packed);
+    }
+
+
+    // За проход планировщика время читается дважды: до задачи и после нее
+    BOOST_FIXTURE_TEST_CASE( testTLoopTimeReads, TTimeSlotFixture ) {
+        TStaticLoop<TMyStaticChain> staticLoop {log};
+        TLoop mtLoop {2, log};
+        mtLoop.Attach({ *slot1, *slot2 });
+        mtLoop.PostAt(1000, { [](TLog&){ return true; } });
+        TTimer::time = 1000;
+        TTimer::increment = 1;
+        for (size_t i = 0; i < 3; ++i) {
+            // Таймер, затем два тайм-слота цепочки
+            tick_t before = TTimer::time;
+            BOOST_CHECK_EQUAL(mtLoop.Run(), true);
+            BOOST_CHECK_EQUAL(TTimer::time - before, 2);
+            TTimer::time = TTimer::time + 200;
+        }
+        tick_t before = TTimer::time;
+        BOOST_CHECK_EQUAL(staticLoop.Run(), true);
+        BOOST_CHECK_EQUAL(TTimer::time - before, 2);
+        TTimer::increment = 0;
+        BOOST_CHECK_EQUAL(log.logLines.size(), 3);
+    }
+
+
+    // Задача на дескрипторе pipe выполняется, как только в pipe появились данные
+    BOOST_FIXTURE_TEST_CASE( testTEpollLoopPipe, TTimeSlotFixture ) {
+        int fds[2];
+        BOOST_REQUIRE(pipe(fds) == 0);
+        TEpollLoop mtLoop {2, log};
+        std::string received;
+        std::string* pReceived = &received;
+        int readFd = fds[0];
+        BOOST_CHECK(mtLoop.Watch(readFd, EPOLLIN, { [pReceived, readFd](TLog&) {
+            char c;
+            if (read(readFd, &c, 1) != 1)
+                return false;
+            *pReceived += c;
+            return true;
+        } }));
+        BOOST_CHECK_EQUAL(mtLoop.GetWatchCount(), 1);
+
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(0), 0);
+        BOOST_CHECK(write(fds[1], "ab", 2) == 2);
+        // По одному байту за событие: level-triggered дескриптор готов, пока данные не прочитаны
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(100), 1);
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(100), 1);
+        BOOST_CHECK_EQUAL(received, "ab");
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(0), 0);
+        BOOST_CHECK(mtLoop.GetStat(readFd) != nullptr);
+
+        BOOST_CHECK(mtLoop.Unwatch(readFd));
+        BOOST_CHECK(!mtLoop.Unwatch(readFd));
+        BOOST_CHECK(write(fds[1], "c", 1) == 1);
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(0), 0);
+        BOOST_CHECK_EQUAL(received, "ab");
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+
+    // Задача по указателю выполняется на каждое событие и удаляется при Unwatch
+    BOOST_FIXTURE_TEST_CASE( testTEpollLoopOwnedTask, TTimeSlotFixture ) {
+        int fds[2];
+        BOOST_REQUIRE(pipe(fds) == 0);
+        {
+            TEpollLoop mtLoop {2, log};
+            BOOST_CHECK(mtLoop.Watch(fds[0], EPOLLIN, new TCountedTask()));
+            BOOST_CHECK(write(fds[1], "a", 1) == 1);
+            // Данные не прочитаны - дескриптор готов на обоих проходах
+            BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(100), 1);
+            BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(100), 1);
+            BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+            BOOST_CHECK_EQUAL(liveTasks, 1);
+            BOOST_CHECK(mtLoop.Unwatch(fds[0]));
+            BOOST_CHECK_EQUAL(liveTasks, 0);
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+
+    // Без событий epoll_wait спит до срока цепочки, затем цепочка выполняется;
+    // eventfd и Submit() из другого потока будят цикл раньше срока
+    BOOST_FIXTURE_TEST_CASE( testTEpollLoopDeadline, TTimeSlotFixture ) {
+        TTimer::time = 1;
+        TEpollLoop mtLoop {2, log};
+        TChainHandle handle = mtLoop.Attach({ *slot1 });
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(), 1);
+        // Следующий тайм-слот через 100 мкс: цикл спит до срока, но мок-время
+        // само не идет, его двигает тест
+        auto start = std::chrono::steady_clock::now();
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(), 0);
+        BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::microseconds(100));
+        BOOST_CHECK_EQUAL(TTimer::time, 1);
+        TTimer::time = 101;
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(), 1);
+        BOOST_CHECK_EQUAL(log.logLines.size(), 2);
+        // WaitAndRun базового TLoop со своим способом сна доступен и здесь
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(TTimer::SleepUntil), 1);
+        BOOST_CHECK_EQUAL(TTimer::time, 201);
+        BOOST_CHECK_EQUAL(log.logLines.size(), 3);
+
+        TEventFd event;
+        size_t notified = 0;
+        size_t* pNotified = &notified;
+        TEventFd* pEvent = &event;
+        BOOST_CHECK(mtLoop.Watch(event.GetFd(), EPOLLIN, { [pNotified, pEvent](TLog&) {
+            *pNotified += pEvent->Drain();
+            return true;
+        } }));
+        // Цепочек и таймеров нет - цикл спит, пока не придет событие
+        BOOST_CHECK(mtLoop.Detach(handle));
+        std::thread notifier([&event]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            event.Notify(3);
+        });
+        BOOST_CHECK_EQUAL(mtLoop.WaitAndRun(2000), 1);
+        notifier.join();
+        BOOST_CHECK_EQUAL(notified, 3);
+
+        bool called = false;
+        bool* pCalled = &called;
+        TLoopCommand call {{ [pCalled](TLog&){ *pCalled = true; return true; } }};
+        // Будит и отправка через ссылку на базовый TLoop
+        TLoop& baseLoop = mtLoop;
+        std::thread submitter([&baseLoop, &call]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            baseLoop.Submit(call);
+        });
+        mtLoop.WaitAndRun(2000);
+        submitter.join();
+        BOOST_CHECK(call.IsDone());
+        BOOST_CHECK(called);
+    }
+
+
+#if MTLOOP_COROUTINES
+    // Сопрограмма запоминает моменты продолжений; второе продолжение длится 5 тиков
+    TCoTask CoResumes(std::vector<tick_t>* resumes) {
+        resumes->push_back(TTimer::GetTime());
+        co_await NextSlot();
+        resumes->push_back(TTimer::GetTime());
+        TTimer::time += 5;
+        co_await NextSlot();
+        resumes->push_back(TTimer::GetTime());
+        co_await SleepFor(30);
+        resumes->push_back(TTimer::GetTime());
+    }
+
+    TCoTask CoForever() {
+        for (;;)
+            co_await NextSlot();
+    }
+
+
+    // NextSlot продолжает сопрограмму в начале следующего тайм-слота,
+    // SleepFor - через заданное число тиков после окончания продолжения
+    BOOST_AUTO_TEST_CASE( testTCoChain ) {
+        TMockLog log;
+        std::vector<tick_t> resumes;
+        TTimer::time = 1;
+        TCoChain chain(CoResumes(&resumes), 100, 10);
+        BOOST_CHECK(!chain.IsDone());
+        BOOST_CHECK(resumes.empty());
+
+        BOOST_CHECK(chain.Run(log));
+        BOOST_CHECK_EQUAL(chain.GetLTime(), 101);
+        TTimer::time = 50;
+        BOOST_CHECK(!chain.Run(log));
+        TTimer::time = 101;
+        BOOST_CHECK(chain.Run(log));
+        BOOST_CHECK_EQUAL(chain.GetStat().GetStartTime(), 101);
+        BOOST_CHECK_EQUAL(chain.GetStat().GetDuration(), 5);
+        BOOST_CHECK_EQUAL(chain.GetLTime(), 201);
+        TTimer::time = 201;
+        BOOST_CHECK(chain.Run(log));
+        BOOST_CHECK_EQUAL(chain.GetLTime(), 231);
+        TTimer::time = 230;
+        BOOST_CHECK(!chain.Run(log));
+        TTimer::time = 231;
+        BOOST_CHECK(chain.Run(log));
+        BOOST_CHECK(chain.IsDone());
+        BOOST_CHECK(resumes == std::vector<tick_t>({ 1, 101, 201, 231 }));
+
+        // Завершенная цепочка больше не выполняется, в том числе через полдиапазона tick_t
+        BOOST_CHECK(chain.IsFinished());
+        BOOST_CHECK(!chain.Run(log));
+        TTimer::time = 231 + (static_cast<tick_t>(-1) >> 1) + 1;
+        BOOST_CHECK(!chain.Run(log));
+    }
+
+
+    // Сопрограммы в TLoop вместе с обычными цепочками
+    BOOST_FIXTURE_TEST_CASE( testTCoChainTLoop, TTimeSlotFixture ) {
+        std::vector<tick_t> resumes;
+        TTimer::time = 1;
+        TLoop mtLoop {4, log};
+        TCoChain chain(CoResumes(&resumes), 100, 10);
+        BOOST_CHECK(mtLoop.Attach(chain));
+        BOOST_CHECK(mtLoop.Attach({ *slot1 }));
+        for (int i = 0; i < 20 && !chain.IsDone(); ++i)
+            mtLoop.WaitAndRun([](tick_t tm) { TTimer::SleepUntil(tm); });
+        BOOST_CHECK(chain.IsDone());
+        BOOST_CHECK(resumes == std::vector<tick_t>({ 1, 101, 201, 231 }));
+        BOOST_CHECK(!log.logLines.empty());
+        // Завершенную цепочку TLoop отсоединил: она не будит RunUntilIdle
+        BOOST_CHECK_EQUAL(mtLoop.GetChainCount(), 1);
+        TTimer::time = TTimer::time + (static_cast<tick_t>(-1) >> 1);
+        BOOST_CHECK_EQUAL(mtLoop.RunUntilIdle(), 1);
+    }
+
+
+    // Кадры берутся из пула и возвращаются в него; без свободного блока
+    // сопрограмма не создается
+    BOOST_AUTO_TEST_CASE( testTCoFramePool ) {
+        const size_t freeCount = CoFramePool().GetFreeCount();
+        BOOST_CHECK_EQUAL(freeCount, MTLOOP_CO_FRAME_COUNT);
+        {
+            std::vector<TCoTask> tasks;
+            for (size_t i = 0; i < freeCount; ++i) {
+                tasks.push_back(CoForever());
+                BOOST_CHECK(tasks.back().IsValid());
+            }
+            BOOST_CHECK_EQUAL(CoFramePool().GetFreeCount(), 0);
+            TCoTask extra = CoForever();
+            BOOST_CHECK(!extra.IsValid());
+            BOOST_CHECK(extra.IsDone());
+
+            TMockLog log;
+            TCoChain chain(std::move(extra));
+            BOOST_CHECK(chain.IsDone());
+            BOOST_CHECK(!chain.Run(log, TTimer::GetTime()));
+            BOOST_CHECK(chain.IsFinished());
+        }
+        BOOST_CHECK_EQUAL(CoFramePool().GetFreeCount(), freeCount);
+
+        TCoFramePool<64, 2> pool;
+        BOOST_CHECK(pool.Allocate(65) == nullptr);
+        void* a = pool.Allocate(64);
+        void* b = pool.Allocate(1);
+        BOOST_CHECK(a != nullptr && b != nullptr && a != b);
+        BOOST_CHECK(pool.Allocate(1) == nullptr);
+        pool.Free(a);
+        BOOST_CHECK(pool.Allocate(1) == a);
+    }
+#endif
+
+
+    // Журнал выполнений: номер цепочки, тайм-слот, плановое и фактическое
+    // начало, окончание и результат, в том числе отказы и разовые задачи
+    BOOST_FIXTURE_TEST_CASE( testTTraceLoop, TTimeSlotFixture ) {
+        TTimer::time = 1;
+        TraceBuffer().Reset();
+        TLoop mtLoop {4, log, DISPATCH_DEADLINE};
+        mtLoop.Attach({ *slot1, *slot2 });
+        mtLoop.Attach({ { { [](TLog&){ return false; } }, 100, 0 } });
+        BOOST_CHECK(mtLoop.Run());
+        BOOST_CHECK(!mtLoop.Run());
+        TTimer::time = 150;
+        BOOST_CHECK(!mtLoop.Run());
+        BOOST_CHECK(mtLoop.Run());
+        mtLoop.PostAt(160, { [](TLog&){ TTimer::time += 3; return true; } });
+        TTimer::time = 160;
+        BOOST_CHECK(!mtLoop.Run());
+        BOOST_CHECK(mtLoop.Run());
+
+        const TTraceBuffer& trace = TraceBuffer();
+        BOOST_REQUIRE_EQUAL(trace.GetSize(), 6);
+        BOOST_CHECK_EQUAL(trace.At(0).chain, 0);
+        BOOST_CHECK_EQUAL(trace.At(0).slot, 0);
+        BOOST_CHECK_EQUAL(trace.At(0).result, true);
+        BOOST_CHECK_EQUAL(trace.At(1).chain, 1);
+        BOOST_CHECK_EQUAL(trace.At(1).result, false);
+        BOOST_CHECK_EQUAL(trace.At(2).chain, 1);
+        BOOST_CHECK_EQUAL(trace.At(2).start, 150);
+        BOOST_CHECK_EQUAL(trace.At(3).chain, 0);
+        BOOST_CHECK_EQUAL(trace.At(3).slot, 1);
+        BOOST_CHECK_EQUAL(trace.At(3).planned, 101);
+        BOOST_CHECK_EQUAL(trace.At(3).start, 150);
+        BOOST_CHECK_EQUAL(trace.At(3).stop, 150);
+        // Отказавшая цепочка просрочена сильнее разовой задачи
+        BOOST_CHECK_EQUAL(trace.At(4).chain, 1);
+        BOOST_CHECK_EQUAL(trace.At(4).start, 160);
+        BOOST_CHECK_EQUAL(trace.At(5).chain, TRACE_TIMER_CHAIN);
+        BOOST_CHECK_EQUAL(trace.At(5).planned, 160);
+        BOOST_CHECK_EQUAL(trace.At(5).stop, 163);
+        BOOST_CHECK_EQUAL(trace.At(5).result, true);
+    }
+
+
+    // Кольцо вытесняет старые события; дамп читается на хосте и превращается
+    // в JSON Chrome trace-event
+    BOOST_AUTO_TEST_CASE( testTTraceDump ) {
+        TTraceBuffer trace;
+        for (uint16_t i = 0; i < 300; ++i)
+            trace.Record(i % 3, i, i * 10, i * 10 + 1, i * 10 + 5, i % 2 == 0);
+        BOOST_CHECK_EQUAL(trace.GetRecorded(), 300);
+        BOOST_REQUIRE_EQUAL(trace.GetSize(), TTraceBuffer::SIZE);
+        BOOST_CHECK_EQUAL(trace.At(0).slot, 300 - TTraceBuffer::SIZE);
+        BOOST_CHECK_EQUAL(trace.At(TTraceBuffer::SIZE - 1).slot, 299);
+
+        std::vector<uint8_t> bytes;
+        trace.Dump([&bytes](uint8_t b) { bytes.push_back(b); });
+        BOOST_CHECK_EQUAL(bytes.size(), 14 + TTraceBuffer::SIZE * (5 + 3 * sizeof(tick_t)));
+        TTraceDump dump;
+        BOOST_REQUIRE(ReadTraceDump(bytes.data(), bytes.size(), dump));
+        BOOST_CHECK_EQUAL(dump.recorded, 300);
+        BOOST_REQUIRE_EQUAL(dump.records.size(), TTraceBuffer::SIZE);
+        const TTraceRecord& last = dump.records.back();
+        BOOST_CHECK_EQUAL(last.chain, 299 % 3);
+        BOOST_CHECK_EQUAL(last.planned, 2990);
+        BOOST_CHECK_EQUAL(last.start, 2991);
+        BOOST_CHECK_EQUAL(last.stop, 2995);
+        BOOST_CHECK(!last.result);
+        BOOST_CHECK(!ReadTraceDump(bytes.data(), bytes.size() - 1, dump));
+
+        std::ostringstream json;
+        WriteChromeTrace(json, dump, 0.5);
+        BOOST_CHECK(json.str().find("\"lost\":" + std::to_string(300 - TTraceBuffer::SIZE)) != std::string::npos);
+        BOOST_CHECK(json.str().find("\"name\":\"chain 2\"") != std::string::npos);
+        BOOST_CHECK(json.str().find("\"name\":\"slot 299 declined\"") != std::string::npos);
+        BOOST_CHECK(json.str().find("\"ts\":1495.5,\"dur\":2") != std::string::npos);
+    }
+
+
+    // 16-битные тики устройства разворачиваются через переполнение
+    BOOST_AUTO_TEST_CASE( testTTraceDumpWrap ) {
+        std::vector<uint8_t> bytes = { 'M', 'T', 'T', 'R', TRACE_DUMP_VERSION, 2, 2, 0, 0, 0, 2, 0, 0, 0 };
+        for (uint16_t start : { uint16_t(65530), uint16_t(5) }) {
+            uint16_t planned = start - 10;
+            uint16_t stop = start + 7;
+            for (uint16_t v : { uint16_t(0), uint16_t(1) })
+                bytes.insert(bytes.end(), { uint8_t(v), uint8_t(v >> 8) });
+            bytes.push_back(1);
+            for (uint16_t v : { planned, start, stop })
+                bytes.insert(bytes.end(), { uint8_t(v), uint8_t(v >> 8) });
+        }
+        TTraceDump dump;
+        BOOST_REQUIRE(ReadTraceDump(bytes.data(), bytes.size(), dump));
+        BOOST_REQUIRE_EQUAL(dump.records.size(), 2);
+        BOOST_CHECK_EQUAL(dump.records[1].planned, 65531);
+        BOOST_CHECK_EQUAL(dump.records[1].start, 65541);
+        BOOST_CHECK_EQUAL(dump.records[1].stop, 65548);
+    }
+
+
+    // Уровень выше MTLOOP_LOG_LEVEL не доходит до Log
+    BOOST_AUTO_TEST_CASE( testTLogLevel ) {
+        TMockLog log;
+        log.Write<LOG_ERROR>("error");
+        log.Write<LOG_INFO>("info");
+        log.Write<LOG_DEBUG>("debug");
+        BOOST_REQUIRE_EQUAL(log.logLines.size(), 2);
+        BOOST_CHECK_EQUAL(log.logLines[0], "error");
+        BOOST_CHECK_EQUAL(log.logLines[1], "info");
+    }
+
+
+    // Отложенный лог форматирует записи только при Flush
+    BOOST_AUTO_TEST_CASE( testTDeferredLog ) {
+        TDeferredLog deferred;
+        TMockLog log;
+        const char* name = "chain";
+        deferred.Write("%s %d: %u%%", name, -42, 7u);
+        deferred.Write<LOG_WARNING>("[%04x|%5d|%3d|%c]", 0xBEEF, 12, -3, 'z');
+        deferred.Write<LOG_DEBUG>("not stored %d", 1);
+        deferred.Write("%ld %d", 5L);
+        deferred.Log("plain");
+        BOOST_CHECK_EQUAL(deferred.GetPending(), 4);
+        BOOST_CHECK(log.logLines.empty());
+
+        BOOST_CHECK_EQUAL(deferred.Flush(log), 4);
+        BOOST_CHECK_EQUAL(deferred.GetPending(), 0);
+        BOOST_REQUIRE_EQUAL(log.logLines.size(), 4);
+        BOOST_CHECK_EQUAL(log.logLines[0], "chain -42: 7%");
+        BOOST_CHECK_EQUAL(log.logLines[1], "[beef|   12| -3|z]");
+        BOOST_CHECK_EQUAL(log.logLines[2], "5 ?");
+        BOOST_CHECK_EQUAL(log.logLines[3], "plain");
+        BOOST_CHECK_EQUAL(deferred.Flush(log), 0);
+    }
+
+
+    // Log() копирует строку: '%' не форматируется, буфер на стеке можно менять
+    BOOST_AUTO_TEST_CASE( testTDeferredLogCopy ) {
+        TDeferredLog deferred;
+        TMockLog log;
+        char line[64];
+        std::snprintf(line, sizeof(line), "load %d%%s", 50);
+        deferred.Log(line);
+        std::snprintf(line, sizeof(line), "overwritten");
+        std::string longLine(2 * sizeof(TLogRecord::text), 'y');
+        deferred.Log(longLine.c_str());
+        BOOST_CHECK_EQUAL(deferred.Flush(log), 2);
+        BOOST_REQUIRE_EQUAL(log.logLines.size(), 2);
+        BOOST_CHECK_EQUAL(log.logLines[0], "load 50%s");
+        // Обрезается по размеру записи
+        BOOST_CHECK_EQUAL(log.logLines[1], std::string(sizeof(TLogRecord::text) - 1, 'y'));
+    }
+
+
+    // Переполненное кольцо теряет новые записи, а не ждет вывода
+    BOOST_AUTO_TEST_CASE( testTDeferredLogOverflow ) {
+        TDeferredLog deferred;
+        for (size_t i = 0; i < TDeferredLog::SIZE + 5; ++i)
+            deferred.Write("record %u", static_cast<unsigned>(i));
+        BOOST_CHECK_EQUAL(deferred.GetPending(), TDeferredLog::SIZE);
+        BOOST_CHECK_EQUAL(deferred.GetDropped(), 5);
+
+        std::vector<std::string> lines;
+        deferred.FlushTo([&lines](const char* line) { lines.push_back(line); });
+        BOOST_REQUIRE_EQUAL(lines.size(), TDeferredLog::SIZE);
+        BOOST_CHECK_EQUAL(lines.front(), "record 0");
+        BOOST_CHECK_EQUAL(lines.back(), "record " + std::to_string(TDeferredLog::SIZE - 1));
+        deferred.Write("after");
+        BOOST_CHECK_EQUAL(deferred.GetPending(), 1);
+
+        // Длинная строка обрезается по MTLOOP_LOG_LINE
+        std::string longArg(2 * MTLOOP_LOG_LINE, 'x');
+        TLogRecord record = { "%s!", {}, 1 };
+        record.args[0].str = longArg.c_str();
+        char line[MTLOOP_LOG_LINE];
+        BOOST_CHECK_EQUAL(TDeferredLog::Format(record, line, sizeof(line)), MTLOOP_LOG_LINE - 1);
+    }
+
+
+    // Задачи пишут в кольцо, фоновый поток выводит записи
+    BOOST_AUTO_TEST_CASE( testTLogThread ) {
+        TDeferredLog deferred;
+        TMockLog log;
+        {
+            TLogThread thread(deferred, log, std::chrono::milliseconds(1));
+            for (int i = 0; i < 1000; ++i) {
+                deferred.Write("tick %d", i);
+                if (i % 50 == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        BOOST_CHECK_EQUAL(log.logLines.size() + deferred.GetDropped(), 1000);
+        BOOST_CHECK_EQUAL(deferred.GetPending(), 0);
+        BOOST_REQUIRE(!log.logLines.empty());
+        BOOST_CHECK_EQUAL(log.logLines.front(), "tick 0");
+    }
+
+
+    // Симуляция 10 минут расписания без холостых проходов
+    BOOST_AUTO_TEST_CASE( testTSimulator ) {
+        TTimer::time = 1;
+        TLoop loop {4};
+        TSimulator sim(loop);
+        // Две цепочки по 1000 тиков на тайм-слот, загрузка 30% и 20%
+        sim.AddChain("sensor", { { TDurationModel::Fixed(300), 1000, 0 } });
+        sim.AddChain("comm", { { TDurationModel::Uniform(100, 300), 1000, 0 } });
+        const uint64_t span = 600ULL * 1000 * 1000;
+        auto started = std::chrono::steady_clock::now();
+        const TSimReport& report = sim.Run(span);
+        auto wall = std::chrono::steady_clock::now() - started;
+
+        BOOST_CHECK_GE(report.elapsed, span);
+        BOOST_CHECK_LT(report.elapsed, span + 1000);
+        BOOST_REQUIRE_EQUAL(report.chains.size(), 2);
+        const TSimChainReport& sensor = report.chains[0];
+        const TSimChainReport& comm = report.chains[1];
+        BOOST_CHECK_EQUAL(sensor.name, "sensor");
+        BOOST_CHECK_CLOSE(sensor.utilization, 0.3, 0.1);
+        BOOST_CHECK_CLOSE(comm.utilization, 0.2, 1);
+        BOOST_CHECK_CLOSE(report.utilization, 0.5, 1);
+        BOOST_CHECK(sensor.runs >= span / 1000 && sensor.runs <= span / 1000 + 1);
+        // Цепочки мешают друг другу не больше одной задачи соседа
+        BOOST_CHECK_LE(sensor.maxLateness, 300);
+        BOOST_CHECK_LE(comm.maxLateness, 300);
+        BOOST_CHECK_EQUAL(sensor.missed + comm.missed, 0);
+        // Проходы только по делу: не больше двух на выполнение
+        BOOST_CHECK_LE(report.passes, 2 * (sensor.runs + comm.runs) + 2);
+        BOOST_CHECK_LT(std::chrono::duration_cast<std::chrono::seconds>(wall).count(), 5);
+        TTimer::time = 1;
+    }
+
+
+    // Перегруженное расписание: пропуски и выход за бюджет видны в отчете
+    BOOST_AUTO_TEST_CASE( testTSimulatorOverload ) {
+        TTimer::time = 1;
+        TLoop loop {4};
+        TSimulator sim(loop, 7);
+        std::vector<tick_t> recorded = { 400, 500, 600 };
+        sim.AddChain("control", { { TDurationModel::Empirical(recorded), 1000, 0, 550 },
+                                  { TDurationModel::Fixed(100), 1000, 0 } }, OVERRUN_SKIP_NEXT);
+        TStat stat;
+        for (tick_t d : { 700, 700, 900 }) {
+            stat.SetStartTime(0);
+            stat.SetStopTime(d);
+            stat.Sample(0);
+        }
+        sim.AddChain("logger", { { TDurationModel::FromStat(stat), 1000, 0 } });
+        std::ostringstream text;
+        WriteSimReport(text, sim.Run(100000));
+        const TSimReport& report = sim.GetReport();
+        BOOST_REQUIRE_EQUAL(report.chains.size(), 2);
+        BOOST_CHECK_GT(report.utilization, 0.9);
+        BOOST_CHECK_GT(report.chains[0].overruns, 0);
+        BOOST_CHECK_GT(report.chains[0].missed + report.chains[1].missed, 0);
+        BOOST_CHECK_GE(report.chains[1].maxLateness, 400);
+        BOOST_CHECK(text.str().find("chain,runs,utilization") != std::string::npos);
+        BOOST_CHECK(text.str().find("\nlogger,") != std::string::npos);
+        // Продолжение копит время
+        sim.Run(50000);
+        BOOST_CHECK_GE(sim.GetReport().elapsed, 150000);
+        TTimer::time = 1;
+    }
+
+
+    // Загрузка, период и граница опоздания по описанию расписания
+    BOOST_AUTO_TEST_CASE( testTScheduleModel ) {
+        TScheduleModel model;
+        model.AddChain("sensor", { { 1000, 0, 300 } });
+        model.AddChain("comm", { { 1000, 0, 200 }, { 500, 100, 450 } });
+        TScheduleAnalysis analysis = model.Analyze();
+        BOOST_REQUIRE_EQUAL(analysis.chains.size(), 2);
+        const TChainAnalysis& sensor = analysis.chains[0];
+        const TChainAnalysis& comm = analysis.chains[1];
+        BOOST_CHECK_EQUAL(sensor.period, 1000);
+        BOOST_CHECK_EQUAL(comm.nominalPeriod, 1500);
+        BOOST_CHECK_EQUAL(comm.period, 1550);     // 450 + 100 не помещается в 500
+        BOOST_CHECK_CLOSE(comm.utilization, 650.0 / 1550, 1e-6);
+        BOOST_CHECK_EQUAL(sensor.lateness, 450);
+        BOOST_CHECK_EQUAL(comm.lateness, 300);
+        BOOST_CHECK(sensor.feasible);
+        BOOST_CHECK(!comm.feasible);
+        BOOST_CHECK(!comm.slots[1].fits);
+        BOOST_CHECK(!analysis.feasible);
+        BOOST_REQUIRE_EQUAL(analysis.problems.size(), 1);
+        BOOST_CHECK(analysis.problems[0].find("comm: slot 1") == 0);
+
+        // На вдвое более медленном процессоре не укладывается и sensor
+        model.GetChain(1).slots[1].minDuration = 1000;
+        BOOST_CHECK(model.Analyze().feasible);
+        model.SetCpuScale(2);
+        analysis = model.Analyze();
+        BOOST_CHECK_EQUAL(analysis.chains[0].slots[0].wcet, 600);
+        BOOST_CHECK(!analysis.chains[0].feasible);
+        BOOST_CHECK_CLOSE(analysis.utilization, 0.6 + 1300.0 / 2000, 1e-6);
+        BOOST_CHECK(!analysis.feasible);
+    }
+
+
+    // Классы приоритета: старший ждет одну младшую задачу, младший - всех старших
+    BOOST_AUTO_TEST_CASE( testTScheduleModelPriority ) {
+        TScheduleModel model(DISPATCH_PRIORITY);
+        model.AddChain("control", { { 1000, 0, 200 } }, 2);
+        model.AddChain("logger", { { 10000, 0, 800 } }, 0);
+        model.AddChain("ui", { { 5000, 0, 300 } }, 0);
+        TScheduleAnalysis analysis = model.Analyze();
+        BOOST_CHECK_EQUAL(analysis.chains[0].lateness, 800);
+        // 300 своего класса и control, пока ждем: (w / 1000 + 1) * 200
+        BOOST_CHECK_EQUAL(analysis.chains[1].lateness, 300 + 200);
+        BOOST_CHECK_EQUAL(analysis.chains[2].lateness, 800 + 2 * 200);     // второй старт control в момент 1000
+        BOOST_CHECK(analysis.feasible);
+
+        // Старшая цепочка без окна занимает процессор без ограничений
+        model.GetChain(0).slots[0].minDuration = 0;
+        analysis = model.Analyze();
+        BOOST_CHECK(analysis.chains[0].feasible);
+        BOOST_CHECK_EQUAL(analysis.chains[1].lateness, UNBOUNDED_LATENESS);
+        BOOST_CHECK(!analysis.feasible);
+        std::ostringstream text;
+        WriteScheduleReport(text, analysis);
+        BOOST_CHECK(text.str().find("logger,0,10000,10000,0.08,unbounded,unbounded,no") != std::string::npos);
+    }
+
+
+    // Граница анализа не меньше опозданий, полученных симуляцией
+    BOOST_AUTO_TEST_CASE( testTScheduleModelSimulated ) {
+        TTimer::time = 1;
+        TLoop loop {4, defaultLog, DISPATCH_DEADLINE};
+        TSimulator sim(loop, 3);
+        sim.AddChain("a", { { TDurationModel::Uniform(50, 250), 1000, 0 }, { TDurationModel::Fixed(100), 1000, 20 } });
+        sim.AddChain("b", { { TDurationModel::Uniform(100, 400), 1500, 10 } });
+        sim.AddChain("c", { { TDurationModel::Normal(150, 50), 2000, 0 } });
+        const TSimReport& report = sim.Run(20000000);
+
+        TScheduleModel model(DISPATCH_DEADLINE);
+        for (size_t i = 0; i < report.chains.size(); ++i)
+            model.AddChain(report.chains[i].name, sim.GetChain(i));
+        TScheduleAnalysis analysis = model.Analyze();
+        BOOST_CHECK_EQUAL(analysis.chains[0].slots[1].wcet, 100);
+        BOOST_CHECK_LE(analysis.chains[1].slots[0].wcet, 400);
+        for (size_t i = 0; i < report.chains.size(); ++i)
+            BOOST_CHECK_LE(report.chains[i].maxLateness, analysis.chains[i].lateness);
+        std::ostringstream text;
+        WriteScheduleReport(text, analysis);
+        BOOST_CHECK_MESSAGE(analysis.feasible, text.str());
+        BOOST_CHECK_EQUAL(report.chains[0].missed + report.chains[1].missed + report.chains[2].missed, 0);
+        TTimer::time = 1;
+    }
+
+
+    // Подстройка окон: период цепочки сходится к времени работы задач
+    BOOST_AUTO_TEST_CASE( testTSlotAutoTune ) {
+        TTimer::time = 1;
+        static std::vector<tick_t> starts;
+        starts.clear();
+        auto work = [](TLog&) { TTimer::time += 100; return true; };
+        TTimeSlotChain chain {
+            { { [](TLog&) { starts.push_back(TTimer::time); TTimer::time += 100; return true; } }, 1000, 50 },
+            { { work }, 1000, 50 },
+            { { work }, 1000, 50 },
+        };
+        chain.SetAutoTune(50, 2000, 0, 50);
+        TLoop loop {1};
+        loop.Attach(chain);
+        while (starts.size() < 40)
+            if (!loop.Run())
+                TTimer::SleepUntil(loop.NextWakeTime());
+        // Первый цикл - заданные вручную окна, последний - работа задач
+        BOOST_CHECK_GE(starts[1] - starts[0], 3 * 100 + 3 * 200);
+        // Задача занимает окно целиком: следующий тайм-слот - со следующего тика
+        BOOST_CHECK_EQUAL(starts[39] - starts[38], 3 * (100 + 1));
+        for (size_t i = 2; i < starts.size(); ++i)
+            BOOST_CHECK_LE(starts[i] - starts[i - 1], starts[i - 1] - starts[i - 2]);
+        BOOST_CHECK_EQUAL(chain.At(1).GetMinDuration(), 100);
+        BOOST_CHECK_EQUAL(chain.At(1).GetPadding(), 0);
+        BOOST_CHECK_EQUAL(chain.At(1).GetTuner().GetMean(), 100);
+        TTimer::time = 1;
+    }
+
+
+    // Неровная задача: окно с запасом на разброс, в границах пользователя
+    BOOST_AUTO_TEST_CASE( testTSlotAutoTuneJitter ) {
+        TTimer::time = 1;
+        static tick_t step = 0;
+        TTimeSlot slot({ [](TLog&) { TTimer::time += (step++ % 2 == 0) ? 100 : 200; return true; } }, 1000, 0);
+        slot.SetAutoTune(120, 300, 0, 20);
+        TTimeSlotChain chain { slot };
+        TLoop loop {1};
+        loop.Attach(chain);
+        for (int i = 0; i < 2000; ++i)
+            if (!loop.Run())
+                TTimer::SleepUntil(loop.NextWakeTime());
+        TTimeSlot& tuned = chain.At(0);
+        BOOST_CHECK_CLOSE(static_cast<double>(tuned.GetTuner().GetMean()), 150.0, 10);
+        BOOST_CHECK_GE(tuned.GetMinDuration(), 200);
+        BOOST_CHECK_LE(tuned.GetMinDuration(), 300);
+        BOOST_CHECK_EQUAL(tuned.GetPadding(), 20);
+        BOOST_CHECK_EQUAL(tuned.GetStat().GetOverrunCount(), 0);
+
+        // После остановки подобранные значения сохраняются
+        tuned.StopAutoTune();
+        tick_t minDuration = tuned.GetMinDuration();
+        for (int i = 0; i < 10; ++i)
+            if (!loop.Run())
+                TTimer::SleepUntil(loop.NextWakeTime());
+        BOOST_CHECK_EQUAL(tuned.GetMinDuration(), minDuration);
+        TTimer::time = 1;
+    }
+
+
+    // Сравнение моментов времени через переполнение счетчика
+    BOOST_AUTO_TEST_CASE( testTimeBeforeWrap ) {
+        const tick_t last = static_cast<tick_t>(0) - 1;
+        BOOST_CHECK(TimeBefore(1, 2));
+        BOOST_CHECK(!TimeBefore(2, 2));
+        BOOST_CHECK(TimeBefore(last, 0));
+        BOOST_CHECK(TimeAfter(5, last - 5));
+        BOOST_CHECK(!TimeAfter(last, 0));
+    }
+
+
+    // Цепочки проходят через переполнение таймера без остановки и без пачки
+    // запусков: период сохраняется
+    BOOST_FIXTURE_TEST_CASE( testTLoopTimeWrap, TTimeSlotFixture ) {
+        const tick_t start = static_cast<tick_t>(0) - 25;
+        std::vector<tick_t> runsA;
+        std::vector<tick_t> runsB;
+        std::vector<tick_t>* pRunsA = &runsA;
+        std::vector<tick_t>* pRunsB = &runsB;
+        TTimeSlot a { { [pRunsA](TLog&){ pRunsA->push_back(TTimer::time); return true; } }, 10, 0 };
+        TTimeSlot b { { [pRunsB](TLog&){ pRunsB->push_back(TTimer::time); return true; } }, 7, 0 };
+        a.SetStartTime(start);
+        b.SetStartTime(start + 3);
+
+        TLoop mtLoop {2, log};
+        mtLoop.Attach({ a });
+        mtLoop.Attach({ b });
+        TTimer::time = start;
+        for (tick_t i = 0; i < 100; ++i) {
+            mtLoop.RunUntilIdle();
+            TTimer::time++;
+        }
+        BOOST_CHECK_EQUAL(runsA.size(), 10);
+        BOOST_CHECK_EQUAL(runsB.size(), 14);
+        for (size_t i = 0; i < runsA.size(); ++i)
+            BOOST_CHECK_EQUAL(runsA[i], static_cast<tick_t>(start + 10 * i));
+        for (size_t i = 0; i < runsB.size(); ++i)
+            BOOST_CHECK_EQUAL(runsB[i], static_cast<tick_t>(start + 3 + 7 * i));
+    }
+
+
+    // Разовые задачи со сроками по обе стороны от переполнения
+    BOOST_FIXTURE_TEST_CASE( testTLoopPostTimeWrap, TTimeSlotFixture ) {
+        // Сроки на нескольких уровнях колеса, но в пределах половины диапазона tick_t
+        const tick_t span = static_cast<tick_t>(1) << (sizeof(tick_t) > 2 ? 20 : 12);
+        const tick_t start = static_cast<tick_t>(0) - span / 2;
+        std::mt19937 rnd(7);
+        std::vector<tick_t> expire;
+        std::vector<tick_t> fired;
+        std::vector<tick_t>* pFired = &fired;
+        TLoop mtLoop {1, log};
+
+        TTimer::time = start;
+        for (size_t i = 0; i < 500; ++i) {
+            tick_t delay = rnd() % span;
+            expire.push_back(start + delay);
+            mtLoop.PostAfter(delay, { [pFired](TLog&){ pFired->push_back(TTimer::time); return true; } });
+        }
+        // NextWakeTime может указывать на перенос таймеров между уровнями колеса,
+        // поэтому проходов больше, чем задач
+        size_t passes = 0;
+        while (fired.size() < expire.size() && passes++ < 10 * expire.size()) {
+            tick_t wakeTime = mtLoop.NextWakeTime();
+            BOOST_CHECK(!TimeBefore(wakeTime, TTimer::time));
+            TTimer::SleepUntil(wakeTime);
+            mtLoop.RunUntilIdle();
+        }
+
+        std::sort(expire.begin(), expire.end(), [start](tick_t x, tick_t y) {
+            return static_cast<tick_t>(x - start) < static_cast<tick_t>(y - start);
+        });
+        BOOST_CHECK((fired == expire));
+    }
+
+
+#ifdef __linux__
+    // Настоящие таймеры Linux: время не убывает, SleepUntil ждет не меньше заданного,
+    // TSC после калибровки идет вровень с CLOCK_MONOTONIC_RAW
+    template<typename Timer>
+    void CheckLinuxTimer() {
+        tick_t t0 = Timer::GetTime();
+        tick_t prev = t0;
+        for (size_t i = 0; i < 1000; ++i) {
+            tick_t tm = Timer::GetTime();
+            BOOST_CHECK(!TimeBefore(tm, prev));
+            prev = tm;
+        }
+        Timer::SleepUntil(t0 + 20000000 / MTLOOP_TICK_NS);
+        BOOST_CHECK(static_cast<tick_t>(Timer::GetTime() - t0) >= 20000000 / MTLOOP_TICK_NS);
+    }
+
+    BOOST_AUTO_TEST_CASE( testLinuxTimers ) {
+        CheckLinuxTimer<TMonotonicTimer>();
+        CheckLinuxTimer<TMonotonicRawTimer>();
+#ifdef __x86_64__
+        CheckLinuxTimer<TTscTimer>();
+        uint64_t tsc0 = TTscTimer::GetNs();
+        uint64_t raw0 = TMonotonicRawTimer::GetNs();
+        SleepNs(50000000);
+        uint64_t tsc = TTscTimer::GetNs() - tsc0;
+        uint64_t raw = TMonotonicRawTimer::GetNs() - raw0;
+        BOOST_CHECK(tsc > raw * 95 / 100 && tsc < raw * 105 / 100);
+#endif
+    }
+#endif
+
+
+    BOOST_AUTO_TEST_CASE( testTLoopEmpty ) {
+        TLoop mtLoop {};
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+        mtLoop.SetDispatchPolicy(DISPATCH_ROUND_ROBIN);
+        BOOST_CHECK_EQUAL(mtLoop.GetDispatchPolicy(), DISPATCH_ROUND_ROBIN);
+        BOOST_CHECK_EQUAL(mtLoop.Run(), false);
+    }
+
 
 
 BOOST_AUTO_TEST_SUITE_END()
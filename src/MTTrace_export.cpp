@@ -0,0 +1,50 @@
+// This is an open source non-commercial project. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+// Конвертер дампа TTraceBuffer в JSON для Perfetto (ui.perfetto.dev) и chrome://tracing.
+//   MTLoop_trace.exe [--us-per-tick N] [dump.bin] > trace.json
+// Без файла дамп читается со стандартного ввода.
+
+#include "MTTrace.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using namespace MT;
+
+int main(int argc, char** argv) {
+    double usPerTick = 1.0;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--us-per-tick") == 0 && i + 1 < argc) {
+            usPerTick = std::atof(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            std::cerr << "usage: " << argv[0] << " [--us-per-tick N] [dump.bin]" << std::endl;
+            return 2;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    std::vector<uint8_t> data;
+    if (path != nullptr) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            std::cerr << "cannot open " << path << std::endl;
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    } else {
+        data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+
+    TTraceDump dump;
+    if (!ReadTraceDump(data.data(), data.size(), dump)) {
+        std::cerr << "not an MTLoop trace dump" << std::endl;
+        return 1;
+    }
+    WriteChromeTrace(std::cout, dump, usPerTick);
+    return 0;
+}